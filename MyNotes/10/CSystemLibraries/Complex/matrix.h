@@ -0,0 +1,960 @@
+/****
+ * Matrix
+ *    A dense row-major matrix of entries of type T (double, float or
+ *    int32_t) and the ways of multiplying two of them: serially with
+ *    the blocked kernel (matrixKernel.h), with forked processes, with a
+ *    pool of threads, recursively (Strassen-Winograd) and out of core
+ *    on matrix files (matrixFile.h).
+ *
+ *    Everything is a template on T, so each type gets its own kernels
+ *    and block sizes at compile time - a float matrix is half the
+ *    memory of a double one and the SIMD kernels do twice the entries
+ *    per instruction.
+ ****/
+
+#ifndef __MATRIX_H
+#define __MATRIX_H
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include "matrixKernel.h"
+#include "threadPool.h"
+#include "matrixFile.h"
+
+// Rows are padded to a multiple of this many bytes (one cache line)
+#define ROW_ALIGN_BYTES 64
+
+// Default size at or below which multMatrixRecursive uses the blocked kernel
+#define DEFAULT_CROSSOVER 1024
+
+// How the answer may be split up between workers
+enum PartitionShape { AUTO, ROWS, COLUMNS, TILES };
+
+// One worker's part of the answer: rows sr..er-1, columns sc..ec-1
+struct Part {
+  int sr, er, sc, ec;
+};
+
+/***
+ * partition:
+ *    Split an nR x nC answer into (at most) K parts for K workers.
+ *    The parts form a grid of pr bands of rows by pc bands of columns
+ *    (pr * pc = K, or fewer parts if the matrix is too small); the band
+ *    edges are spread evenly so no band is more than one row/column
+ *    bigger than another.
+ *    ROWS forces pc = 1, COLUMNS forces pr = 1.  AUTO tries every
+ *    factoring of K and picks the one whose biggest part has the least
+ *    work (rows * cols) and then the least to read (a part reads
+ *    rows + cols rows/columns of the two operands), so tall matrices
+ *    get split by rows, wide ones by columns and big square ones by tiles.
+ ***/
+inline std::vector<Part> partition(int nR, int nC, int K, PartitionShape shape=AUTO) {
+  if (K > nR * nC) K = nR * nC;
+  if (K < 1) K = 1;
+
+  int pr = 1, pc = 1;
+  long bestWork = -1, bestTraffic = -1;
+  int f;
+  for (f = 1; f <= K; f++) {
+    if (K % f != 0) continue;
+    int tryR = f, tryC = K / f;
+    if (tryR > nR || tryC > nC) continue;
+    if (shape == ROWS && tryC != 1) continue;
+    if (shape == COLUMNS && tryR != 1) continue;
+    long rows = (nR + tryR - 1) / tryR, cols = (nC + tryC - 1) / tryC;
+    long work = rows * cols, traffic = rows + cols;
+    if (bestWork < 0 || work < bestWork || (work == bestWork && traffic < bestTraffic)) {
+      bestWork = work;
+      bestTraffic = traffic;
+      pr = tryR;
+      pc = tryC;
+    }
+  }
+  if (bestWork < 0) {
+    // K does not factor to fit (or the forced shape does not fit) -
+    // use as many bands of the longer side as there are rows/columns
+    if (shape == COLUMNS || (shape != ROWS && nC > nR)) pc = std::min(K, nC);
+    else pr = std::min(K, nR);
+  }
+
+  std::vector<Part> parts;
+  int i, j;
+  for (i = 0; i < pr; i++) {
+    for (j = 0; j < pc; j++) {
+      Part part;
+      part.sr = (long) nR * i / pr;
+      part.er = (long) nR * (i + 1) / pr;
+      part.sc = (long) nC * j / pc;
+      part.ec = (long) nC * (j + 1) / pc;
+      parts.push_back(part);
+    }
+  }
+  return parts;
+}
+
+/***
+ * getPool:
+ *    The thread pool with the given number of threads.  Made on first use
+ *    and only remade if a different number of threads is asked for.
+ ***/
+inline ThreadPool* getPool(int threads) {
+  static ThreadPool* pool = NULL;
+  if (pool != NULL && pool->size() != threads) {
+    delete pool;
+    pool = NULL;
+  }
+  if (pool == NULL) pool = new ThreadPool(threads);
+  return pool;
+}
+
+template <typename T>
+class Matrix {
+private:
+  T* a;          // All the entries, row by row (64-byte aligned)
+  int nR;
+  int nC;
+  int stride;    // Distance between the start of two rows (nC rounded up to a cache line)
+
+  // Where a lives
+  enum Storage {
+    HEAP_MEMORY,     // posix_memalign
+    SHARED_MEMORY,   // A shared anonymous mapping (seen by forked children)
+    MAPPED_FILE      // Inside file (a private mapping of a matrix file)
+  } storage;
+  MappedMatrixFile file;
+
+  // The blocked kernel: answer[sr..er)[sc..ec) = this[sr..er) * other[..][sc..ec)
+  void multBlocked(Matrix* other, Matrix* answer, int sr, int er, int sc, int ec);
+
+  // Bytes in the buffer
+  size_t bytes() { return (size_t) nR * stride * sizeof(T); }
+
+  // The two ways multMatrixParallelDuo gets the children's parts back
+  Matrix* parallelDuoPipes(Matrix* other, std::vector<Part>& parts);
+  Matrix* parallelDuoShared(Matrix* other, std::vector<Part>& parts);
+
+  // The buffer is owned - no copies
+  Matrix(const Matrix&);
+  Matrix& operator=(const Matrix&);
+
+  // A matrix using the entries of an already mapped matrix file (REFERENCE is STOLEN)
+  Matrix(MappedMatrixFile& mapped) : storage(MAPPED_FILE), file(mapped) {
+    a = (T*) file.data();
+    nR = file.header->rows;
+    nC = file.header->cols;
+    stride = file.header->stride;
+  }
+
+public:
+  /***
+   * Create an nR x nC matrix of zeros
+   *    If _shared, the entries are put in a MAP_SHARED anonymous mapping
+   *    so children forked afterwards write into the very same memory.
+   ***/
+  Matrix(int _nR, int _nC, bool shared=false) : nR(_nR), nC(_nC) {
+    const int perRow = ROW_ALIGN_BYTES / sizeof(T);
+    stride = (nC + perRow - 1) / perRow * perRow;
+    storage = shared ? SHARED_MEMORY : HEAP_MEMORY;
+    size_t size = bytes() > 0 ? bytes() : 1;
+    if (shared) {
+      // Fresh anonymous pages are already zero (and page aligned)
+      void* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (buffer == MAP_FAILED) {
+	std::cerr << "Error mapping matrix, aborting: " << strerror(errno) << std::endl;
+	exit(1);
+      }
+      a = (T*) buffer;
+    } else {
+      void* buffer;
+      if (posix_memalign(&buffer, ROW_ALIGN_BYTES, size) != 0) {
+	std::cerr << "Error allocating matrix, aborting: " << strerror(ENOMEM) << std::endl;
+	exit(1);
+      }
+      a = (T*) buffer;
+      memset(a, 0, bytes());
+    }
+  }
+
+  ~Matrix() {
+    if (storage == SHARED_MEMORY) munmap(a, bytes() > 0 ? bytes() : 1);
+    else if (storage == MAPPED_FILE) unmapMatrixFile(file);
+    else free(a);
+  }
+
+  int getNumRows() { return nR; }
+  int getNumCols() { return nC; }
+
+  // Start of row r (the entries of a row are contiguous)
+  T* row(int r) { return a + (size_t) r * stride; }
+
+  // Note neither of these performs proper bounds checking
+  // which would be essential in a well-written C++ program!!!
+  T getValue(int r, int c) {
+    assert (r < nR && r >= 0);
+    assert (c < nC && c >= 0);
+    return row(r)[c];
+  }
+
+  void setValue(int r, int c, T value) { row(r)[c] = value; }
+
+  /***
+   * fill the matrix with random values from min to max
+   *    (rounded towards zero for an integer matrix)
+   ***/
+  void fillMatrix(double min, double max);
+
+  /***
+   * Print out the matrix
+   ***/
+  void printMatrix();
+
+  /***
+   * Load a matrix from a matrix file (see matrixFile.h)
+   *    The file is mapped, not read: pages are brought in as they are used
+   *    and changes to the matrix are not written back.
+   *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+   *    or NULL (after printing why) if the file cannot be used.
+   ***/
+  static Matrix* loadMatrix(const char* path);
+
+  /***
+   * Save the matrix to path as a matrix file
+   *    Returns false (after printing why) if it could not be written.
+   ***/
+  bool saveMatrix(const char* path);
+
+  /***
+   * Multiply two matrix files (cPath = aPath * bPath) out of core
+   *    Only bands of the three files are in memory at once - their
+   *    height is picked so they fit in budget bytes.
+   *    Returns false (after printing why) on failure.
+   ***/
+  static bool multMatrixFiles(const char* aPath, const char* bPath, const char* cPath, size_t budget);
+
+  /***
+   * Multiply the current matrix by the matrix other
+   *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+   ***/
+  Matrix* multMatrix(Matrix& other) { return multMatrix(&other); } // Wrapper for next method
+  Matrix* multMatrix(Matrix* other);
+  Matrix* multMatrix(Matrix* other, int sr, int er, int sc, int ec);
+
+  /***
+   * Multiply the current matrix but in parallel
+   *    Just to illustrate how it could be done
+   ***/
+  Matrix* multMatrixParallel(Matrix& other) { return multMatrixParallel(&other); }
+  Matrix* multMatrixParallel(Matrix* other);
+
+  /***
+   * Multiply the current matrix using K processes (each does one part
+   * of the answer - a band of rows, of columns or a tile, see partition)
+   *    By default the answer is in shared memory the children write into;
+   *    with usePipes they send their parts back through pipes instead.
+   ***/
+  Matrix* multMatrixParallelDuo(Matrix& other, int K=2, bool usePipes=false, PartitionShape shape=AUTO) {
+    return multMatrixParallelDuo(&other, K, usePipes, shape);
+  }
+  Matrix* multMatrixParallelDuo(Matrix* other, int K=2, bool usePipes=false, PartitionShape shape=AUTO);
+
+  /***
+   * Multiply the current matrix using a pool of threads
+   *    The answer is cut into tiles which the threads take (and steal
+   *    from each other) until all are done.  The pool is kept and
+   *    reused by later calls asking for the same number of threads.
+   *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+   ***/
+  Matrix* multMatrixThreaded(Matrix& other, int threads) { return multMatrixThreaded(&other, threads); }
+  Matrix* multMatrixThreaded(Matrix* other, int threads);
+
+  /***
+   * Multiply the current (square) matrix by other (same size) recursively
+   *    The matrices are split into quadrants until they are at most
+   *    crossover on a side, where the blocked kernel takes over.  With
+   *    strassen each split does 7 half-size products (Strassen-Winograd)
+   *    instead of 8 - fewer FLOPs but slightly less accurate.  The
+   *    subproblems of the top split run in parallel on threads threads.
+   *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+   ***/
+  Matrix* multMatrixRecursive(Matrix& other, int crossover=DEFAULT_CROSSOVER, bool strassen=true, int threads=1) {
+    return multMatrixRecursive(&other, crossover, strassen, threads);
+  }
+  Matrix* multMatrixRecursive(Matrix* other, int crossover=DEFAULT_CROSSOVER, bool strassen=true, int threads=1);
+
+  /***
+   * The largest difference between an entry of this and of other
+   *    (which must be the same size)
+   ***/
+  double maxDifference(Matrix& other);
+
+  /***
+   * The largest difference between an entry of this and of other
+   *    (same size), relative to the largest entry of other
+   ***/
+  double relativeDifference(Matrix* other) {
+    double biggest = other->maxAbs();
+    return biggest > 0 ? maxDifference(*other) / biggest : maxDifference(*other);
+  }
+
+  /***
+   * The largest entry of the matrix (in absolute value)
+   ***/
+  double maxAbs();
+};
+
+/***
+ * fill the matrix with random values from min to max
+ ***/
+template <typename T>
+void Matrix<T>::fillMatrix(double min, double max) {
+  int r, c;
+  for (r = 0; r < nR; r++) {
+    for (c = 0; c < nC; c++) {
+      double zeroToOne = random() / (double) RAND_MAX;   // A value from [0,1)
+      double value = zeroToOne * (max - min) + min;
+      row(r)[c] = (T) value;
+    }
+  }
+}
+
+template <typename T>
+void Matrix<T>::printMatrix() {
+  // The following two IO Manipulators (for C++) apply to all output (until changed again)
+  std::fixed(std::cout);  // Make the floating points print out in fixed value (with decimals)
+  std::cout << std::setprecision(4);  // The precision level
+  int r, c;
+  for (r = 0; r < nR; r++) {
+    for (c = 0; c < nC; c++) {
+      std::cout << std::setw(10) << row(r)[c] << " ";  // setw manipulator is only for next value!
+    }
+    std::cout << std::endl;
+  }
+}
+
+/***
+ * multBlocked:
+ *    Compute rows sr..er-1, columns sc..ec-1 of answer = this * other
+ *    (answer must start out zero there) with the blocked kernel
+ *    of matrixKernel.h
+ ***/
+template <typename T>
+void Matrix<T>::multBlocked(Matrix* other, Matrix* answer, int sr, int er, int sc, int ec) {
+  multiplyBlocked(this->row(sr), this->stride, other->row(0) + sc, other->stride,
+		  answer->row(sr) + sc, answer->stride, er - sr, ec - sc, this->nC);
+}
+
+/***
+ * loadMatrix:
+ *    Maps the file copy-on-write so the matrix can be changed freely
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::loadMatrix(const char* path) {
+  MappedMatrixFile mapped;
+  if (!mapMatrixFile(path, FILE_COPY, mapped)) return NULL;
+  if (mapped.header->dtype != DtypeOf<T>::value || mapped.header->elementSize != sizeof(T)) {
+    std::cerr << "Error reading " << path << ": not a matrix of " << DtypeOf<T>::name() << std::endl;
+    unmapMatrixFile(mapped);
+    return NULL;
+  }
+  return new Matrix(mapped);
+}
+
+/***
+ * saveMatrix:
+ *    Creates the file at its full size, maps it and copies the rows in
+ ***/
+template <typename T>
+bool Matrix<T>::saveMatrix(const char* path) {
+  MappedMatrixFile out = { NULL, 0 };
+  if (!createMatrixFile(path, nR, nC, DtypeOf<T>::value, sizeof(T), out)) return false;
+  T* data = (T*) out.data();
+  int r;
+  for (r = 0; r < nR; r++) {
+    memcpy(data + r * out.header->stride, row(r), nC * sizeof(T));
+  }
+  unmapMatrixFile(out);
+  return true;
+}
+
+/***
+ * multMatrixFiles:
+ *    C is done a band of t rows at a time: C band += A band's columns
+ *    k..k+t-1 * B's rows k..k+t-1, for each band of t rows of B.
+ *    So in memory at once are a band of A and C and two bands of B
+ *    (the current one and the next, being prefetched):
+ *       t * (cols of A + 3 * cols of B) entries, kept under budget.
+ *    Each band is madvise'd WILLNEED (the kernel starts reading it in)
+ *    while the one before it is being multiplied, and DONTNEED once it is
+ *    finished with, so the pages mapped never exceed the budget.
+ ***/
+template <typename T>
+bool Matrix<T>::multMatrixFiles(const char* aPath, const char* bPath, const char* cPath, size_t budget) {
+  MappedMatrixFile A, B, C;
+  if (!mapMatrixFile(aPath, FILE_READ, A)) return false;
+  if (!mapMatrixFile(bPath, FILE_READ, B)) {
+    unmapMatrixFile(A);
+    return false;
+  }
+  if (A.header->dtype != DtypeOf<T>::value || B.header->dtype != DtypeOf<T>::value
+      || A.header->cols != B.header->rows) {
+    std::cerr << "Error: " << aPath << " and " << bPath
+	      << " must be matrices of " << DtypeOf<T>::name() << " with matching sizes" << std::endl;
+    unmapMatrixFile(A);
+    unmapMatrixFile(B);
+    return false;
+  }
+  if (!createMatrixFile(cPath, A.header->rows, B.header->cols, DtypeOf<T>::value, sizeof(T), C)) {
+    unmapMatrixFile(A);
+    unmapMatrixFile(B);
+    return false;
+  }
+
+  size_t m = A.header->rows, p = A.header->cols, n = B.header->cols;
+  size_t lda = A.header->stride, ldb = B.header->stride, ldc = C.header->stride;
+  T* a = (T*) A.data();
+  T* b = (T*) B.data();
+  T* c = (T*) C.data();
+
+  size_t t = budget / (sizeof(T) * (lda + 3 * ldb));
+  t = std::max((size_t) 1, std::min(t, std::max(m, p)));
+
+  size_t i, k;
+  for (i = 0; i < m; i += t) {
+    size_t ti = std::min(t, m - i);
+    T* aBand = a + i * lda;
+    T* cBand = c + i * ldc;
+    if (i + t < m) adviseRange(aBand + t * lda, std::min(t, m - i - t) * lda * sizeof(T), MADV_WILLNEED);
+
+    for (k = 0; k < p; k += t) {
+      size_t tk = std::min(t, p - k);
+      T* bBand = b + k * ldb;
+
+      // Prefetch the next band of B (the first one again for the next band of A)
+      size_t next = (k + t < p) ? k + t : 0;
+      if (next != 0 || i + t < m) {
+	adviseRange(b + next * ldb, std::min(t, p - next) * ldb * sizeof(T), MADV_WILLNEED);
+      }
+
+      multiplyBlocked(aBand + k, lda, bBand, ldb, cBand, ldc, ti, n, tk);
+      if (p > t) adviseRange(bBand, tk * ldb * sizeof(T), MADV_DONTNEED);
+    }
+
+    // Done with this band of A and C (C's pages stay in the file)
+    adviseRange(aBand, ti * lda * sizeof(T), MADV_DONTNEED);
+    adviseRange(cBand, ti * ldc * sizeof(T), MADV_DONTNEED);
+  }
+
+  unmapMatrixFile(A);
+  unmapMatrixFile(B);
+  unmapMatrixFile(C);
+  return true;
+}
+
+/***
+ * maxDifference:
+ *    The largest difference between an entry of this and of other
+ ***/
+template <typename T>
+double Matrix<T>::maxDifference(Matrix& other) {
+  assert(nR == other.nR && nC == other.nC);
+  double most = 0.0;
+  int r, c;
+  for (r = 0; r < nR; r++) {
+    for (c = 0; c < nC; c++) {
+      double diff = fabs((double) row(r)[c] - (double) other.row(r)[c]);
+      if (diff > most) most = diff;
+    }
+  }
+  return most;
+}
+
+/***
+ * Multiply the current matrix by the matrix other
+ *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::multMatrix(Matrix* other) {
+  assert(this->nC == other->nR);  // Number of cols in this must match number of rows in other!
+  Matrix* answer = new Matrix(this->nR, other->nC);
+  multBlocked(other, answer, 0, answer->nR, 0, answer->nC);
+  return answer;
+}
+
+template <typename T>
+Matrix<T>* Matrix<T>::multMatrix(Matrix* other, int sr, int er, int sc, int ec) {
+  Matrix* answer = new Matrix(this->nR, other->nC);
+  multBlocked(other, answer, sr, er, sc, ec);
+  return answer;
+}
+
+/***
+ * Multiply the current matrix by the matrix other
+ *    Returns a new allocated matrix (REFERENCE IS GIVEN to caller)
+ *    This version does the multiplication in parallel (using forks)
+ *    Of course, with only a few processors this version has too much
+ *    overhead to be truly effective (I would guess)  Test to see...
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::multMatrixParallel(Matrix* other) {
+  assert(this->nC == other->nR);  // Number of cols in this must match number of rows in other!
+  Matrix* answer = new Matrix(this->nR, other->nC);
+
+  int comm[this->nR][other->nC][2];  // Pipes for each entry to multiply
+  int r, c;
+  for (r = 0; r < answer->nR; r++) {
+    for (c = 0; c < answer->nC; c++) {
+      // Create a process to perform the task for this row/column
+      // First, we need a pipe for communication (the costly part really)
+      if (pipe(comm[r][c]) == -1) {
+	// Error creating pipe
+	char* errorMessage = strerror(errno);
+	std::cerr << "Error creating pipe, aborting: " << errorMessage << std::endl;
+	exit(1);
+      }
+      pid_t cid = fork();
+      if (cid == -1) {
+	// Error forking new process
+	char* errorMessage = strerror(errno);
+	std::cerr << "Error forking new process, aborting: " << errorMessage << std::endl;
+	exit(1);
+      }
+      if (cid == 0) {
+	// Child process, do the child work (its copy of answer starts out zero)
+	multBlocked(other, answer, r, r+1, c, c+1);
+	T sum = answer->row(r)[c];
+	write(comm[r][c][1], &sum, sizeof(T));
+	exit(0); // Dont forget this!!! (See what happens if you dont do this statement!)
+      }
+    }
+  }
+
+  // Now we have all processes working, let us read each one back
+  // Could do a wait and check for each process as they complete but here we need them
+  // all anyway
+  for (r = 0; r < answer->nR; r++) {
+    for (c = 0; c < answer->nC; c++) {
+      T sum;
+      read(comm[r][c][0], &sum, sizeof(T));
+      answer->row(r)[c] = sum;
+      close(comm[r][c][0]);
+      close(comm[r][c][1]);
+    }
+  }
+  return answer;
+}
+
+/***
+ * multMatrixParallelDuo:
+ *    This is a far better parallel multiply than the previous
+ *    matrix operation.  Works by dividing the answer into K parts
+ *    (see partition) and assigning them to K processes.  (K-1 children).
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::multMatrixParallelDuo(Matrix* other, int K, bool usePipes, PartitionShape shape) {
+  assert(this->nC == other->nR);  // Number of cols in this must match number of rows in other!
+  std::vector<Part> parts = partition(this->nR, other->nC, K, shape);
+  if (usePipes) return parallelDuoPipes(other, parts);
+  return parallelDuoShared(other, parts);
+}
+
+/***
+ * parallelDuoShared:
+ *    The answer is created in a shared mapping before forking, so each
+ *    child computes its part straight into it - nothing is copied
+ *    and no read/write calls are made.  The parent does the last part
+ *    and then just waits for the children.
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::parallelDuoShared(Matrix* other, std::vector<Part>& parts) {
+  Matrix* answer = new Matrix(this->nR, other->nC, true);
+  int K = parts.size();
+  pid_t children[K];
+  int p;
+
+  for (p = 0; p < K-1; p++) {
+    children[p] = fork();
+    if (children[p] == -1) {
+      // Error forking new process
+      char* errorMessage = strerror(errno);
+      std::cerr << "Error forking new process, aborting: " << errorMessage << std::endl;
+      exit(1);
+    }
+
+    if (children[p] == 0) {
+      // I am the child.  Compute my part in place
+      multBlocked(other, answer, parts[p].sr, parts[p].er, parts[p].sc, parts[p].ec);
+      exit(0);
+    }
+  }
+
+  // I am the parent.
+  //   Do the last part, then wait for the rest
+  multBlocked(other, answer, parts[K-1].sr, parts[K-1].er, parts[K-1].sc, parts[K-1].ec);
+  for (p = 0; p < K-1; p++) {
+    while (waitpid(children[p], NULL, 0) == -1 && errno == EINTR) ;
+  }
+  return answer;
+}
+
+/***
+ * parallelDuoPipes:
+ *    The original version: each child computes its part and writes
+ *    it back up a pipe (one entry per write) for the parent to read.
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::parallelDuoPipes(Matrix* other, std::vector<Part>& parts) {
+  int K = parts.size();
+  int comm[K][2];  // Pipes for each child
+  pid_t children[K];
+  int p, r, c;
+
+  for (p = 0; p < K-1; p++) {
+    if (pipe(comm[p]) == -1) {
+      // Error creating pipe
+      char* errorMessage = strerror(errno);
+      std::cerr << "Error creating pipe, aborting: " << errorMessage << std::endl;
+      exit(1);
+    }
+    children[p] = fork();
+    if (children[p] == -1) {
+      // Error forking new process
+      char* errorMessage = strerror(errno);
+      std::cerr << "Error forking new process, aborting: " << errorMessage << std::endl;
+      exit(1);
+    }
+
+    if (children[p] == 0) {
+      // I am the child.
+      // Compute the submatrix mult (my part)
+      Part& part = parts[p];
+      Matrix* answer = multMatrix(other, part.sr, part.er, part.sc, part.ec);
+
+      // Send the results up the pipe
+      for (r = part.sr; r < part.er; r++) {
+	for (c = part.sc; c < part.ec; c++) {
+	  write(comm[p][1], &(answer->row(r)[c]), sizeof(T));
+	}
+      }
+      delete answer;
+      exit(0);
+    }
+    close(comm[p][1]);   // Only the child writes
+  }
+
+  // I am the parent.
+  //   Do the last part
+  Part& last = parts[K-1];
+  Matrix* answer = multMatrix(other, last.sr, last.er, last.sc, last.ec);
+
+  // Read the results from the each pipe of the children
+  for (p = 0; p < K-1; p++) {
+    Part& part = parts[p];
+    for (r = part.sr; r < part.er; r++) {
+      for (c = part.sc; c < part.ec; c++) {
+	read(comm[p][0], &(answer->row(r)[c]), sizeof(T));
+      }
+    }
+    close(comm[p][0]);
+    while (waitpid(children[p], NULL, 0) == -1 && errno == EINTR) ;
+  }
+  return answer;
+}
+
+/***
+ * multMatrixThreaded:
+ *    Each task computes one tile of the answer, MC rows by NC/2 columns
+ *    of the kernel's blocking for T (tiles are numbered row by row) -
+ *    the tiles do not overlap so the threads never write to the same place.
+ ***/
+template <typename T>
+Matrix<T>* Matrix<T>::multMatrixThreaded(Matrix* other, int threads) {
+  assert(this->nC == other->nR);  // Number of cols in this must match number of rows in other!
+  Matrix* answer = new Matrix(this->nR, other->nC);
+
+  const int TILE_ROWS = KernelTraits<T>::MC, TILE_COLS = KernelTraits<T>::NC / 2;
+  int tileRows = (answer->nR + TILE_ROWS - 1) / TILE_ROWS;
+  int tileCols = (answer->nC + TILE_COLS - 1) / TILE_COLS;
+  getPool(threads)->run(tileRows * tileCols, [=](int t) {
+      int sr = (t / tileCols) * TILE_ROWS;
+      int sc = (t % tileCols) * TILE_COLS;
+      multBlocked(other, answer, sr, std::min(sr + TILE_ROWS, answer->nR),
+		  sc, std::min(sc + TILE_COLS, answer->nC));
+    });
+  return answer;
+}
+
+/***
+ * Scratch:
+ *    A scratch arena for multMatrixRecursive: one buffer that
+ *    temporaries are carved from in stack order (take, then release
+ *    back to an earlier mark) - no allocation per subproblem.
+ ***/
+template <typename T>
+struct Scratch {
+  T* base;
+  size_t size;   // In entries
+  size_t used;
+
+  T* take(size_t count) {
+    assert(used + count <= size);
+    T* ans = base + used;
+    used += count;
+    return ans;
+  }
+};
+
+// A square n x n piece of some matrix: its first entry and row stride
+template <typename T>
+struct Square {
+  T* p;
+  size_t ld;
+  int n;
+
+  T* row(int r) { return p + r * ld; }
+
+  // Quadrant (qr, qc) of an even-sized square
+  Square quad(int qr, int qc) {
+    Square q = { p + qr * (n/2) * ld + qc * (n/2), ld, n/2 };
+    return q;
+  }
+};
+
+/***
+ * newSquare:
+ *    An n x n temporary from the scratch arena
+ ***/
+template <typename T>
+inline Square<T> newSquare(Scratch<T>& scratch, int n) {
+  Square<T> s = { scratch.take((size_t) n * n), (size_t) n, n };
+  return s;
+}
+
+/***
+ * combine:
+ *    D = X + sign * Y
+ ***/
+template <typename T>
+inline void combine(Square<T> D, Square<T> X, Square<T> Y, T sign) {
+  int r, c;
+  for (r = 0; r < D.n; r++) {
+    T* d = D.row(r), *x = X.row(r), *y = Y.row(r);
+    for (c = 0; c < D.n; c++) d[c] = x[c] + sign * y[c];
+  }
+}
+
+/***
+ * accumulate:
+ *    D += sign * X   (or D = X if sign is 0)
+ ***/
+template <typename T>
+inline void accumulate(Square<T> D, Square<T> X, T sign) {
+  int r, c;
+  for (r = 0; r < D.n; r++) {
+    T* d = D.row(r), *x = X.row(r);
+    if (sign == 0) memcpy(d, x, D.n * sizeof(T));
+    else for (c = 0; c < D.n; c++) d[c] += sign * x[c];
+  }
+}
+
+/***
+ * recursiveNeeds:
+ *    Scratch (in entries) the sequential Strassen-Winograd of an n x n
+ *    product uses: three half-size temporaries per level
+ ***/
+inline size_t recursiveNeeds(int n, int crossover) {
+  if (n <= crossover || n % 2 != 0) return 0;
+  size_t h = n / 2;
+  return 3 * h * h + recursiveNeeds(n / 2, crossover);
+}
+
+/***
+ * classicalAdd:
+ *    C += A * B by splitting into 8 quadrant products (cache-oblivious)
+ *    down to the crossover size
+ ***/
+template <typename T>
+inline void classicalAdd(Square<T> A, Square<T> B, Square<T> C, int crossover) {
+  if (C.n <= crossover || C.n % 2 != 0) {
+    multiplyBlocked(A.p, A.ld, B.p, B.ld, C.p, C.ld, C.n, C.n, C.n);
+    return;
+  }
+  int i, j, k;
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 2; j++) {
+      for (k = 0; k < 2; k++) classicalAdd(A.quad(i, k), B.quad(k, j), C.quad(i, j), crossover);
+    }
+  }
+}
+
+/***
+ * winograd:
+ *    C = A * B by Strassen-Winograd, one product at a time:
+ *    each of the 7 half-size products goes into one temporary and is
+ *    added into the quadrants of C that use it right away, so only
+ *    three temporaries (S, T and M) are needed per level:
+ *       S1 = A21 + A22   T1 = B12 - B11   M5 = S1 T1
+ *       S2 = S1 - A11    T2 = B22 - T1    M6 = S2 T2
+ *       S4 = A12 - S2    T4 = T2 - B21    M3 = S4 B22   M4 = A22 T4
+ *       S3 = A11 - A21   T3 = B22 - B12   M7 = S3 T3
+ *       M1 = A11 B11     M2 = A12 B21
+ *       C11 = M1 + M2           C12 = M1 + M6 + M5 + M3
+ *       C21 = M1 + M6 + M7 - M4 C22 = M1 + M6 + M7 + M5
+ ***/
+template <typename E>
+inline void winograd(Square<E> A, Square<E> B, Square<E> C, int crossover, Scratch<E>& scratch) {
+  if (C.n <= crossover || C.n % 2 != 0) {
+    for (int r = 0; r < C.n; r++) memset(C.row(r), 0, C.n * sizeof(E));
+    multiplyBlocked(A.p, A.ld, B.p, B.ld, C.p, C.ld, C.n, C.n, C.n);
+    return;
+  }
+
+  size_t mark = scratch.used;
+  int h = C.n / 2;
+  Square<E> S = newSquare(scratch, h), T = newSquare(scratch, h), M = newSquare(scratch, h);
+  Square<E> A11 = A.quad(0,0), A12 = A.quad(0,1), A21 = A.quad(1,0), A22 = A.quad(1,1);
+  Square<E> B11 = B.quad(0,0), B12 = B.quad(0,1), B21 = B.quad(1,0), B22 = B.quad(1,1);
+  Square<E> C11 = C.quad(0,0), C12 = C.quad(0,1), C21 = C.quad(1,0), C22 = C.quad(1,1);
+
+  winograd(A11, B11, M, crossover, scratch);          // M1
+  accumulate<E>(C11, M, 0); accumulate<E>(C12, M, 0); accumulate<E>(C21, M, 0); accumulate<E>(C22, M, 0);
+  winograd(A12, B21, M, crossover, scratch);          // M2
+  accumulate<E>(C11, M, 1);
+
+  combine<E>(S, A21, A22, 1); combine<E>(T, B12, B11, -1);  // S1, T1
+  winograd(S, T, M, crossover, scratch);              // M5
+  accumulate<E>(C12, M, 1); accumulate<E>(C22, M, 1);
+
+  combine<E>(S, S, A11, -1); combine<E>(T, B22, T, -1);     // S2, T2
+  winograd(S, T, M, crossover, scratch);              // M6
+  accumulate<E>(C12, M, 1); accumulate<E>(C21, M, 1); accumulate<E>(C22, M, 1);
+
+  combine<E>(S, A12, S, -1); combine<E>(T, T, B21, -1);     // S4, T4
+  winograd(S, B22, M, crossover, scratch);            // M3
+  accumulate<E>(C12, M, 1);
+  winograd(A22, T, M, crossover, scratch);            // M4
+  accumulate<E>(C21, M, -1);
+
+  combine<E>(S, A11, A21, -1); combine<E>(T, B22, B12, -1); // S3, T3
+  winograd(S, T, M, crossover, scratch);              // M7
+  accumulate<E>(C21, M, 1); accumulate<E>(C22, M, 1);
+
+  scratch.used = mark;
+}
+
+/***
+ * multMatrixRecursive:
+ *    Every split down to the crossover must be even, so unless the size
+ *    already is N = m * 2^L (m <= crossover) the matrices are first
+ *    copied, zero padded, into squares of that size.  The top split's subproblems (the 7 Winograd
+ *    products, each with its own part of the scratch arena, or the 4
+ *    quadrants of the answer) then run as tasks on the thread pool;
+ *    everything below that is sequential.
+ ***/
+template <typename E>
+Matrix<E>* Matrix<E>::multMatrixRecursive(Matrix* other, int crossover, bool strassen, int threads) {
+  assert(this->nC == other->nR);  // Number of cols in this must match number of rows in other!
+  if (nR != nC || other->nR != other->nC || crossover < 1) return multMatrix(other);
+
+  int m = nR, levels = 0;
+  while (m > crossover) { m = (m + 1) / 2; levels++; }
+  int N = m << levels;
+  if (levels == 0) return multMatrix(other);
+
+  // Scratch: padded copies of A, B and C (if needed), then (for Winograd)
+  // the top split's S1..S4, T1..T4 and M1..M7, then an arena for each product
+  bool padded = (N != nR);
+  int h = N / 2;
+  size_t square = (size_t) N * N, quarter = (size_t) h * h;
+  size_t perProduct = recursiveNeeds(h, crossover);
+  Scratch<E> scratch;
+  scratch.size = (padded ? 3 * square : 0) + (strassen ? 15 * quarter + 7 * perProduct : 0);
+  scratch.base = new E[scratch.size];
+  scratch.used = 0;
+
+  Matrix* answer = new Matrix(nR, other->nC);
+  Square<E> A = { this->a, (size_t) this->stride, N };
+  Square<E> B = { other->a, (size_t) other->stride, N };
+  Square<E> C = { answer->a, (size_t) answer->stride, N };
+  int r;
+  if (padded) {
+    A = newSquare(scratch, N);
+    B = newSquare(scratch, N);
+    C = newSquare(scratch, N);
+    memset(A.p, 0, 3 * square * sizeof(E));
+    for (r = 0; r < nR; r++) {
+      memcpy(A.row(r), this->row(r), nC * sizeof(E));
+      memcpy(B.row(r), other->row(r), nC * sizeof(E));
+    }
+  }
+
+  ThreadPool* pool = getPool(threads);
+  if (!strassen) {
+    // C starts at zero - each task adds the two products of one quadrant
+    pool->run(4, [=](int q) {
+	Square<E> Cq = C;
+	int i = q / 2, j = q % 2;
+	classicalAdd(Square<E>(A).quad(i, 0), Square<E>(B).quad(0, j), Cq.quad(i, j), crossover);
+	classicalAdd(Square<E>(A).quad(i, 1), Square<E>(B).quad(1, j), Cq.quad(i, j), crossover);
+      });
+  } else {
+    Square<E> A11 = A.quad(0,0), A12 = A.quad(0,1), A21 = A.quad(1,0), A22 = A.quad(1,1);
+    Square<E> B11 = B.quad(0,0), B12 = B.quad(0,1), B21 = B.quad(1,0), B22 = B.quad(1,1);
+    Square<E> S[4], T[4], M[7];
+    int i;
+    for (i = 0; i < 4; i++) { S[i] = newSquare(scratch, h); T[i] = newSquare(scratch, h); }
+    for (i = 0; i < 7; i++) M[i] = newSquare(scratch, h);
+    combine<E>(S[0], A21, A22, 1);  combine<E>(T[0], B12, B11, -1);   // S1, T1
+    combine<E>(S[1], S[0], A11, -1); combine<E>(T[1], B22, T[0], -1); // S2, T2
+    combine<E>(S[2], A11, A21, -1); combine<E>(T[2], B22, B12, -1);   // S3, T3
+    combine<E>(S[3], A12, S[1], -1); combine<E>(T[3], T[1], B21, -1); // S4, T4
+
+    // The 7 products (M1..M7), each with its own slice of the arena
+    Square<E> left[7] = { A11, A12, S[3], A22, S[0], S[1], S[2] };
+    Square<E> right[7] = { B11, B21, B22, T[3], T[0], T[1], T[2] };
+    E* arenas = scratch.take(7 * perProduct);
+    pool->run(7, [&](int p) {
+	Scratch<E> mine = { arenas + p * perProduct, perProduct, 0 };
+	winograd(left[p], right[p], M[p], crossover, mine);
+      });
+
+    // C11 = M1 + M2, C12 = M1 + M6 + M5 + M3, C21 = M1 + M6 + M7 - M4, C22 = M1 + M6 + M7 + M5
+    Square<E> C11 = C.quad(0,0), C12 = C.quad(0,1), C21 = C.quad(1,0), C22 = C.quad(1,1);
+    combine<E>(C11, M[0], M[1], 1);
+    combine<E>(C12, M[0], M[5], 1); accumulate<E>(C12, M[4], 1); accumulate<E>(C12, M[2], 1);
+    combine<E>(C21, M[0], M[5], 1); accumulate<E>(C21, M[6], 1); accumulate<E>(C21, M[3], -1);
+    combine<E>(C22, M[0], M[5], 1); accumulate<E>(C22, M[6], 1); accumulate<E>(C22, M[4], 1);
+  }
+
+  if (padded) {
+    for (r = 0; r < nR; r++) memcpy(answer->row(r), C.row(r), nC * sizeof(E));
+  }
+  delete[] scratch.base;
+  return answer;
+}
+
+/***
+ * maxAbs:
+ *    The largest entry (in absolute value)
+ ***/
+template <typename T>
+double Matrix<T>::maxAbs() {
+  double most = 0.0;
+  int r, c;
+  for (r = 0; r < nR; r++) {
+    for (c = 0; c < nC; c++) most = std::max(most, fabs((double) row(r)[c]));
+  }
+  return most;
+}
+
+#endif
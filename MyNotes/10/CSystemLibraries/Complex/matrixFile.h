@@ -0,0 +1,168 @@
+/****
+ * Matrix File
+ *    A simple binary on-disk matrix format, used through mmap:
+ *
+ *       offset 0    MatrixFileHeader (64 bytes)
+ *       dataOffset  rows * stride entries, row by row
+ *
+ *    The data starts on a page boundary and every row is padded to a
+ *    multiple of 64 bytes, so a mapped file can be used in place.
+ *    All fields are in the machine's byte order.
+ ****/
+
+#ifndef __MATRIX_FILE_H
+#define __MATRIX_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+
+#define MATRIX_FILE_MAGIC "MATRIX01"
+#define MATRIX_FILE_ALIGN 4096   // The data starts at a multiple of this
+#define MATRIX_ROW_ALIGN 64      // Each row is padded to a multiple of this many bytes
+
+// Type of the entries
+enum MatrixDtype { DTYPE_FLOAT64 = 1, DTYPE_FLOAT32 = 2, DTYPE_INT32 = 3 };
+
+// The dtype of entries of type T (and its name, for messages)
+template <typename T> struct DtypeOf;
+template <> struct DtypeOf<double>  { static const MatrixDtype value = DTYPE_FLOAT64; static const char* name() { return "doubles"; } };
+template <> struct DtypeOf<float>   { static const MatrixDtype value = DTYPE_FLOAT32; static const char* name() { return "floats"; } };
+template <> struct DtypeOf<int32_t> { static const MatrixDtype value = DTYPE_INT32;   static const char* name() { return "int32s"; } };
+
+struct MatrixFileHeader {
+  char magic[8];          // MATRIX_FILE_MAGIC (not NUL terminated)
+  uint32_t dtype;         // A MatrixDtype
+  uint32_t elementSize;   // Bytes per entry
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t stride;        // Entries from the start of one row to the next
+  uint64_t dataOffset;    // Bytes from the start of the file to row 0
+  char reserved[16];
+};
+
+// How a file is mapped
+enum MatrixFileAccess {
+  FILE_READ,    // Read only
+  FILE_COPY,    // Writable, but changes stay private (copy on write)
+  FILE_WRITE    // Writable, changes go to the file
+};
+
+struct MappedMatrixFile {
+  MatrixFileHeader* header;   // Start of the mapping
+  size_t length;              // Bytes mapped
+
+  void* data() { return (char*) header + header->dataOffset; }
+};
+
+/***
+ * reportFileError:
+ *    Print an error about path (with the current errno) - always false
+ ***/
+inline bool reportFileError(const char* what, const char* path) {
+  std::cerr << "Error " << what << " " << path << ": " << strerror(errno) << std::endl;
+  return false;
+}
+
+/***
+ * mapMatrixFile:
+ *    Map an existing matrix file and check its header.
+ *    Returns false (after printing why) if it cannot be used.
+ ***/
+inline bool mapMatrixFile(const char* path, MatrixFileAccess access, MappedMatrixFile& file) {
+  int fd = open(path, access == FILE_WRITE ? O_RDWR : O_RDONLY);
+  if (fd == -1) return reportFileError("opening", path);
+
+  struct stat info;
+  if (fstat(fd, &info) == -1) {
+    close(fd);
+    return reportFileError("reading", path);
+  }
+  if ((size_t) info.st_size < sizeof(MatrixFileHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return reportFileError("reading (too short)", path);
+  }
+
+  int prot = (access == FILE_READ) ? PROT_READ : PROT_READ | PROT_WRITE;
+  int flags = (access == FILE_COPY) ? MAP_PRIVATE : MAP_SHARED;
+  void* base = mmap(NULL, info.st_size, prot, flags, fd, 0);
+  close(fd);   // The mapping keeps the file open
+  if (base == MAP_FAILED) return reportFileError("mapping", path);
+
+  file.header = (MatrixFileHeader*) base;
+  file.length = info.st_size;
+  MatrixFileHeader* h = file.header;
+  if (memcmp(h->magic, MATRIX_FILE_MAGIC, sizeof(h->magic)) != 0 || h->stride < h->cols
+      || h->dataOffset % MATRIX_FILE_ALIGN != 0
+      || h->dataOffset + h->rows * h->stride * h->elementSize > file.length) {
+    munmap(base, file.length);
+    errno = EINVAL;
+    return reportFileError("reading (not a matrix file)", path);
+  }
+  return true;
+}
+
+/***
+ * createMatrixFile:
+ *    Create (or truncate) path as a rows x cols matrix file of zeros
+ *    and map it writable.  Returns false (after printing why) on failure.
+ ***/
+inline bool createMatrixFile(const char* path, uint64_t rows, uint64_t cols,
+			     MatrixDtype dtype, uint32_t elementSize, MappedMatrixFile& file) {
+  uint64_t perRow = MATRIX_ROW_ALIGN / elementSize;
+  uint64_t stride = (cols + perRow - 1) / perRow * perRow;
+  uint64_t dataOffset = MATRIX_FILE_ALIGN;   // The header fits in the first page
+  size_t length = dataOffset + rows * stride * elementSize;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) return reportFileError("creating", path);
+  if (ftruncate(fd, length) == -1) {   // The new pages read as zeros
+    close(fd);
+    return reportFileError("sizing", path);
+  }
+  void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return reportFileError("mapping", path);
+
+  file.header = (MatrixFileHeader*) base;
+  file.length = length;
+  MatrixFileHeader* h = file.header;
+  memcpy(h->magic, MATRIX_FILE_MAGIC, sizeof(h->magic));
+  h->dtype = dtype;
+  h->elementSize = elementSize;
+  h->rows = rows;
+  h->cols = cols;
+  h->stride = stride;
+  h->dataOffset = dataOffset;
+  return true;
+}
+
+/***
+ * unmapMatrixFile:
+ *    Release the mapping (changes to a FILE_WRITE mapping are in the file)
+ ***/
+inline void unmapMatrixFile(MappedMatrixFile& file) {
+  if (file.header != NULL) munmap(file.header, file.length);
+  file.header = NULL;
+}
+
+/***
+ * adviseRange:
+ *    madvise the pages covering [start, start+length)
+ *    (widened to page boundaries, as madvise requires)
+ ***/
+inline void adviseRange(const void* start, size_t length, int advice) {
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t from = (uintptr_t) start & ~(pageSize - 1);
+  uintptr_t to = ((uintptr_t) start + length + pageSize - 1) & ~(pageSize - 1);
+  if (to > from) madvise((void*) from, to - from, advice);
+}
+
+#endif
@@ -0,0 +1,434 @@
+/****
+ * Matrix Kernel
+ *    The cache-blocked multiply C += A * B on row-major arrays of
+ *    double, float or int32_t (each given by its first entry and
+ *    row stride).
+ *
+ *    B is packed KC x NC at a time and A MC x KC at a time into slivers,
+ *    and a register-blocked micro-kernel runs each MR-row sliver of A
+ *    against each NR-column sliver of B:
+ *                 double   float    int32_t
+ *       AVX2      6 x 8    6 x 16   6 x 16    (12 ymm accumulators, FMA for floats)
+ *       SSE       4 x 4    4 x 8    4 x 8     ( 8 xmm accumulators, SSE4.1 for ints)
+ *       scalar    4 x 4    4 x 4    4 x 4
+ *    The best one the CPU supports is picked (once per type) at run time
+ *    (useKernel can pick another, to compare them).
+ *    The block sizes are fixed per type at compile time (KernelTraits),
+ *    so a block holds the same number of bytes whatever the type.
+ ****/
+
+#ifndef __MATRIX_KERNEL_H
+#define __MATRIX_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS
+#include <immintrin.h>
+#endif
+
+// Largest micro-kernel of any type (for the edge scratch block)
+#define MAX_MR 6
+#define MAX_NR 16
+
+/***
+ * KernelTraits<T>:
+ *    Block sizes for entries of type T: a KC x NC panel of B stays in L2,
+ *    an MC x KC block of A and one sliver of the panel in L1
+ *    (MC and NC are multiples of every kernel's MR and NR)
+ ***/
+template <typename T> struct KernelTraits;
+
+template <> struct KernelTraits<double> {
+  static constexpr int MC = 96, KC = 256, NC = 512;
+  static constexpr bool integer = false;
+};
+
+template <> struct KernelTraits<float> {
+  static constexpr int MC = 96, KC = 512, NC = 512;
+  static constexpr bool integer = false;
+};
+
+template <> struct KernelTraits<int32_t> {
+  static constexpr int MC = 96, KC = 512, NC = 512;
+  static constexpr bool integer = true;
+};
+
+template <typename T>
+struct Kernel {
+  const char* name;
+  int mr;             // Rows of C done per call
+  int nr;             // Columns of C done per call
+  void (*run)(int kc, const T* a, const T* b, T* C, size_t ldc);   // C[0..mr)[0..nr) += a-sliver * b-sliver
+};
+
+/***
+ * scalarKernel:
+ *    The portable 4 x 4 micro-kernel (sums kept in locals)
+ ***/
+template <typename T>
+inline void scalarKernel(int kc, const T* a, const T* b, T* C, size_t ldc) {
+  T sum[4][4] = {{0}};
+  int k, r, c;
+  for (k = 0; k < kc; k++, a += 4, b += 4) {
+    for (r = 0; r < 4; r++) {
+      for (c = 0; c < 4; c++) sum[r][c] += a[r] * b[c];
+    }
+  }
+  for (r = 0; r < 4; r++) {
+    for (c = 0; c < 4; c++) C[r * ldc + c] += sum[r][c];
+  }
+}
+
+#ifdef SIMD_KERNELS
+/***
+ * sseKernel:
+ *    4 x 4 (double) or 4 x 8 (float, int32_t) micro-kernel:
+ *    each row of C is two xmm registers
+ ***/
+__attribute__((target("sse2")))
+inline void sseKernel(int kc, const double* a, const double* b, double* C, size_t ldc) {
+  __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+  __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+  __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+  __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+  int k;
+  for (k = 0; k < kc; k++, a += 4, b += 4) {
+    __m128d b0 = _mm_loadu_pd(b), b1 = _mm_loadu_pd(b + 2);
+    __m128d x;
+    x = _mm_set1_pd(a[0]); c00 = _mm_add_pd(c00, _mm_mul_pd(x, b0)); c01 = _mm_add_pd(c01, _mm_mul_pd(x, b1));
+    x = _mm_set1_pd(a[1]); c10 = _mm_add_pd(c10, _mm_mul_pd(x, b0)); c11 = _mm_add_pd(c11, _mm_mul_pd(x, b1));
+    x = _mm_set1_pd(a[2]); c20 = _mm_add_pd(c20, _mm_mul_pd(x, b0)); c21 = _mm_add_pd(c21, _mm_mul_pd(x, b1));
+    x = _mm_set1_pd(a[3]); c30 = _mm_add_pd(c30, _mm_mul_pd(x, b0)); c31 = _mm_add_pd(c31, _mm_mul_pd(x, b1));
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm_storeu_pd(C + r * ldc,     _mm_add_pd(_mm_loadu_pd(C + r * ldc), lo)); \
+  _mm_storeu_pd(C + r * ldc + 2, _mm_add_pd(_mm_loadu_pd(C + r * ldc + 2), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+#undef ADD_ROW
+}
+
+__attribute__((target("sse2")))
+inline void sseKernel(int kc, const float* a, const float* b, float* C, size_t ldc) {
+  __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+  __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+  __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+  __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+  int k;
+  for (k = 0; k < kc; k++, a += 4, b += 8) {
+    __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4);
+    __m128 x;
+    x = _mm_set1_ps(a[0]); c00 = _mm_add_ps(c00, _mm_mul_ps(x, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(x, b1));
+    x = _mm_set1_ps(a[1]); c10 = _mm_add_ps(c10, _mm_mul_ps(x, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(x, b1));
+    x = _mm_set1_ps(a[2]); c20 = _mm_add_ps(c20, _mm_mul_ps(x, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(x, b1));
+    x = _mm_set1_ps(a[3]); c30 = _mm_add_ps(c30, _mm_mul_ps(x, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(x, b1));
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm_storeu_ps(C + r * ldc,     _mm_add_ps(_mm_loadu_ps(C + r * ldc), lo)); \
+  _mm_storeu_ps(C + r * ldc + 4, _mm_add_ps(_mm_loadu_ps(C + r * ldc + 4), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+#undef ADD_ROW
+}
+
+// SSE2 has no 32-bit multiply keeping the low halves - that is SSE4.1
+__attribute__((target("sse4.1")))
+inline void sseKernel(int kc, const int32_t* a, const int32_t* b, int32_t* C, size_t ldc) {
+  __m128i c00 = _mm_setzero_si128(), c01 = _mm_setzero_si128();
+  __m128i c10 = _mm_setzero_si128(), c11 = _mm_setzero_si128();
+  __m128i c20 = _mm_setzero_si128(), c21 = _mm_setzero_si128();
+  __m128i c30 = _mm_setzero_si128(), c31 = _mm_setzero_si128();
+  int k;
+  for (k = 0; k < kc; k++, a += 4, b += 8) {
+    __m128i b0 = _mm_loadu_si128((const __m128i*) b), b1 = _mm_loadu_si128((const __m128i*) (b + 4));
+    __m128i x;
+    x = _mm_set1_epi32(a[0]); c00 = _mm_add_epi32(c00, _mm_mullo_epi32(x, b0)); c01 = _mm_add_epi32(c01, _mm_mullo_epi32(x, b1));
+    x = _mm_set1_epi32(a[1]); c10 = _mm_add_epi32(c10, _mm_mullo_epi32(x, b0)); c11 = _mm_add_epi32(c11, _mm_mullo_epi32(x, b1));
+    x = _mm_set1_epi32(a[2]); c20 = _mm_add_epi32(c20, _mm_mullo_epi32(x, b0)); c21 = _mm_add_epi32(c21, _mm_mullo_epi32(x, b1));
+    x = _mm_set1_epi32(a[3]); c30 = _mm_add_epi32(c30, _mm_mullo_epi32(x, b0)); c31 = _mm_add_epi32(c31, _mm_mullo_epi32(x, b1));
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm_storeu_si128((__m128i*) (C + r * ldc), _mm_add_epi32(_mm_loadu_si128((__m128i*) (C + r * ldc)), lo)); \
+  _mm_storeu_si128((__m128i*) (C + r * ldc + 4), _mm_add_epi32(_mm_loadu_si128((__m128i*) (C + r * ldc + 4)), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+#undef ADD_ROW
+}
+
+/***
+ * avx2Kernel:
+ *    6 x 8 (double) or 6 x 16 (float, int32_t) micro-kernel: each row
+ *    of C is two ymm registers, updated with one fused multiply-add
+ *    (a multiply and an add for ints) per register per step
+ ***/
+__attribute__((target("avx2,fma")))
+inline void avx2Kernel(int kc, const double* a, const double* b, double* C, size_t ldc) {
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+  __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+  int k;
+  for (k = 0; k < kc; k++, a += 6, b += 8) {
+    __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+    __m256d x;
+    x = _mm256_broadcast_sd(a + 0); c00 = _mm256_fmadd_pd(x, b0, c00); c01 = _mm256_fmadd_pd(x, b1, c01);
+    x = _mm256_broadcast_sd(a + 1); c10 = _mm256_fmadd_pd(x, b0, c10); c11 = _mm256_fmadd_pd(x, b1, c11);
+    x = _mm256_broadcast_sd(a + 2); c20 = _mm256_fmadd_pd(x, b0, c20); c21 = _mm256_fmadd_pd(x, b1, c21);
+    x = _mm256_broadcast_sd(a + 3); c30 = _mm256_fmadd_pd(x, b0, c30); c31 = _mm256_fmadd_pd(x, b1, c31);
+    x = _mm256_broadcast_sd(a + 4); c40 = _mm256_fmadd_pd(x, b0, c40); c41 = _mm256_fmadd_pd(x, b1, c41);
+    x = _mm256_broadcast_sd(a + 5); c50 = _mm256_fmadd_pd(x, b0, c50); c51 = _mm256_fmadd_pd(x, b1, c51);
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm256_storeu_pd(C + r * ldc,     _mm256_add_pd(_mm256_loadu_pd(C + r * ldc), lo)); \
+  _mm256_storeu_pd(C + r * ldc + 4, _mm256_add_pd(_mm256_loadu_pd(C + r * ldc + 4), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+  ADD_ROW(4, c40, c41);
+  ADD_ROW(5, c50, c51);
+#undef ADD_ROW
+}
+
+__attribute__((target("avx2,fma")))
+inline void avx2Kernel(int kc, const float* a, const float* b, float* C, size_t ldc) {
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+  int k;
+  for (k = 0; k < kc; k++, a += 6, b += 16) {
+    __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+    __m256 x;
+    x = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(x, b0, c00); c01 = _mm256_fmadd_ps(x, b1, c01);
+    x = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(x, b0, c10); c11 = _mm256_fmadd_ps(x, b1, c11);
+    x = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(x, b0, c20); c21 = _mm256_fmadd_ps(x, b1, c21);
+    x = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(x, b0, c30); c31 = _mm256_fmadd_ps(x, b1, c31);
+    x = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(x, b0, c40); c41 = _mm256_fmadd_ps(x, b1, c41);
+    x = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(x, b0, c50); c51 = _mm256_fmadd_ps(x, b1, c51);
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm256_storeu_ps(C + r * ldc,     _mm256_add_ps(_mm256_loadu_ps(C + r * ldc), lo)); \
+  _mm256_storeu_ps(C + r * ldc + 8, _mm256_add_ps(_mm256_loadu_ps(C + r * ldc + 8), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+  ADD_ROW(4, c40, c41);
+  ADD_ROW(5, c50, c51);
+#undef ADD_ROW
+}
+
+__attribute__((target("avx2")))
+inline void avx2Kernel(int kc, const int32_t* a, const int32_t* b, int32_t* C, size_t ldc) {
+  __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+  __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+  __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+  __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+  __m256i c40 = _mm256_setzero_si256(), c41 = _mm256_setzero_si256();
+  __m256i c50 = _mm256_setzero_si256(), c51 = _mm256_setzero_si256();
+  int k;
+  for (k = 0; k < kc; k++, a += 6, b += 16) {
+    __m256i b0 = _mm256_loadu_si256((const __m256i*) b), b1 = _mm256_loadu_si256((const __m256i*) (b + 8));
+    __m256i x;
+#define MUL_ADD(c, x, b) _mm256_add_epi32(c, _mm256_mullo_epi32(x, b))
+    x = _mm256_set1_epi32(a[0]); c00 = MUL_ADD(c00, x, b0); c01 = MUL_ADD(c01, x, b1);
+    x = _mm256_set1_epi32(a[1]); c10 = MUL_ADD(c10, x, b0); c11 = MUL_ADD(c11, x, b1);
+    x = _mm256_set1_epi32(a[2]); c20 = MUL_ADD(c20, x, b0); c21 = MUL_ADD(c21, x, b1);
+    x = _mm256_set1_epi32(a[3]); c30 = MUL_ADD(c30, x, b0); c31 = MUL_ADD(c31, x, b1);
+    x = _mm256_set1_epi32(a[4]); c40 = MUL_ADD(c40, x, b0); c41 = MUL_ADD(c41, x, b1);
+    x = _mm256_set1_epi32(a[5]); c50 = MUL_ADD(c50, x, b0); c51 = MUL_ADD(c51, x, b1);
+#undef MUL_ADD
+  }
+#define ADD_ROW(r, lo, hi) \
+  _mm256_storeu_si256((__m256i*) (C + r * ldc), _mm256_add_epi32(_mm256_loadu_si256((__m256i*) (C + r * ldc)), lo)); \
+  _mm256_storeu_si256((__m256i*) (C + r * ldc + 8), _mm256_add_epi32(_mm256_loadu_si256((__m256i*) (C + r * ldc + 8)), hi));
+  ADD_ROW(0, c00, c01);
+  ADD_ROW(1, c10, c11);
+  ADD_ROW(2, c20, c21);
+  ADD_ROW(3, c30, c31);
+  ADD_ROW(4, c40, c41);
+  ADD_ROW(5, c50, c51);
+#undef ADD_ROW
+}
+#endif
+
+/***
+ * supportedKernels:
+ *    The micro-kernels for type T this CPU can run (from what CPUID
+ *    says it supports), best first - worked out on the first call
+ ***/
+template <typename T>
+inline const std::vector<const Kernel<T>*>& supportedKernels() {
+  static const std::vector<const Kernel<T>*> supported = [] {
+    static const Kernel<T> scalar = { "scalar", 4, 4, scalarKernel<T> };
+    std::vector<const Kernel<T>*> list;
+#ifdef SIMD_KERNELS
+    const bool integer = KernelTraits<T>::integer;
+    static const Kernel<T> sse = { integer ? "SSE4.1" : "SSE2", 4, (int) (32 / sizeof(T)), sseKernel };
+    static const Kernel<T> avx2 = { integer ? "AVX2" : "AVX2/FMA", 6, (int) (64 / sizeof(T)), avx2Kernel };
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (integer || __builtin_cpu_supports("fma"))) list.push_back(&avx2);
+    if (integer ? __builtin_cpu_supports("sse4.1") : __builtin_cpu_supports("sse2")) list.push_back(&sse);
+#endif
+    list.push_back(&scalar);
+    return list;
+  }();
+  return supported;
+}
+
+// The micro-kernel in use for type T (the best supported one unless useKernel changed it)
+template <typename T>
+inline const Kernel<T>*& chosenKernel() {
+  static const Kernel<T>* chosen = supportedKernels<T>()[0];
+  return chosen;
+}
+
+/***
+ * pickKernel:
+ *    The micro-kernel to use for entries of type T
+ ***/
+template <typename T>
+inline const Kernel<T>* pickKernel() {
+  return chosenKernel<T>();
+}
+
+/***
+ * useKernel:
+ *    Use the supported micro-kernel for T whose name starts with name
+ *    (ignoring case: "avx2", "sse", "scalar") from now on - for
+ *    comparing them.  Not to be called while a multiply is running.
+ *    Returns false (and changes nothing) if there is no such kernel.
+ ***/
+template <typename T>
+inline bool useKernel(const char* name) {
+  const std::vector<const Kernel<T>*>& list = supportedKernels<T>();
+  for (size_t i = 0; i < list.size(); i++) {
+    if (strncasecmp(list[i]->name, name, strlen(name)) == 0) {
+      chosenKernel<T>() = list[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/***
+ * packPanel:
+ *    Copy the kc x nc block of B (row stride ldb) into nr-wide slivers:
+ *    sliver j holds columns j*nr.. as kc consecutive rows of nr values
+ *    (short last sliver padded with zeros).
+ ***/
+template <typename T>
+inline void packPanel(const T* B, size_t ldb, int kc, int nc, int nr, T* panel) {
+  int j, k, c;
+  for (j = 0; j < nc; j += nr) {
+    int w = std::min(nr, nc - j);
+    for (k = 0; k < kc; k++) {
+      const T* from = B + k * ldb + j;
+      for (c = 0; c < w; c++) panel[c] = from[c];
+      for (; c < nr; c++) panel[c] = 0;
+      panel += nr;
+    }
+  }
+}
+
+/***
+ * packBlock:
+ *    Copy the mc x kc block of A (row stride lda) into mr-high slivers:
+ *    sliver i holds rows i*mr.. as kc consecutive columns of mr values
+ *    (short last sliver padded with zeros).
+ ***/
+template <typename T>
+inline void packBlock(const T* A, size_t lda, int mc, int kc, int mr, T* block) {
+  int i, k, r;
+  for (i = 0; i < mc; i += mr) {
+    int h = std::min(mr, mc - i);
+    for (k = 0; k < kc; k++) {
+      for (r = 0; r < h; r++) block[r] = A[(i + r) * lda + k];
+      for (; r < mr; r++) block[r] = 0;
+      block += mr;
+    }
+  }
+}
+
+/***
+ * PackBuffers:
+ *    The packed panel of B and block of A.  Each thread gets its own
+ *    set (per type), made on first use and kept until the thread exits
+ *    (so a thread multiplying tile after tile does not reallocate them).
+ ***/
+template <typename T>
+struct PackBuffers {
+  typedef KernelTraits<T> Sizes;
+  T* panel;
+  T* block;
+  PackBuffers() : panel(new T[Sizes::KC * Sizes::NC]), block(new T[Sizes::MC * Sizes::KC]) { }
+  ~PackBuffers() { delete[] panel; delete[] block; }
+};
+
+/***
+ * multiplyBlocked:
+ *    C[0..m)[0..n) += A[0..m)[0..p) * B[0..p)[0..n)
+ *    lda, ldb, ldc are the row strides of A, B and C.
+ *    Edge blocks smaller than the kernel are computed into a scratch
+ *    block and only their valid part is added to C.
+ ***/
+template <typename T>
+inline void multiplyBlocked(const T* A, size_t lda, const T* B, size_t ldb,
+			    T* C, size_t ldc, int m, int n, int p) {
+  const int MC = KernelTraits<T>::MC, KC = KernelTraits<T>::KC, NC = KernelTraits<T>::NC;
+  const Kernel<T>* kernel = pickKernel<T>();
+  int mr = kernel->mr, nr = kernel->nr;
+  static thread_local PackBuffers<T> buffers;
+  T* panel = buffers.panel;
+  T* block = buffers.block;
+  T edge[MAX_MR * MAX_NR];
+  int jc, pc, ic, i, j, r, c;
+
+  for (jc = 0; jc < n; jc += NC) {
+    int nc = std::min(NC, n - jc);
+    for (pc = 0; pc < p; pc += KC) {
+      int kc = std::min(KC, p - pc);
+      packPanel(B + pc * ldb + jc, ldb, kc, nc, nr, panel);
+
+      for (ic = 0; ic < m; ic += MC) {
+	int mc = std::min(MC, m - ic);
+	packBlock(A + ic * lda + pc, lda, mc, kc, mr, block);
+
+	for (j = 0; j < nc; j += nr) {
+	  for (i = 0; i < mc; i += mr) {
+	    T* to = C + (ic + i) * ldc + jc + j;
+	    int h = std::min(mr, mc - i), w = std::min(nr, nc - j);
+	    if (h == mr && w == nr) {
+	      kernel->run(kc, block + i * kc, panel + j * kc, to, ldc);
+	    } else {
+	      std::fill(edge, edge + mr * nr, T(0));
+	      kernel->run(kc, block + i * kc, panel + j * kc, edge, nr);
+	      for (r = 0; r < h; r++) {
+		for (c = 0; c < w; c++) to[r * ldc + c] += edge[r * nr + c];
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,193 @@
+/****
+ * Thread Pool
+ *    A fixed set of worker threads, created once and reused for every
+ *    job.  A job is "run task(i) for every i from 0 to count-1".
+ *
+ *    Each worker has its own deque of task numbers.  A job is dealt out
+ *    to the deques in contiguous chunks; a worker takes from the back of
+ *    its own deque and, once that is empty, steals from the front of the
+ *    others'.  So a slow core (or a chunk of expensive tasks) just ends
+ *    up with fewer tasks rather than holding up the whole job.
+ *
+ *    A job can also be a graph of tasks (runGraph): it starts with
+ *    only the tasks that are ready, and a running task adds tasks that
+ *    become ready (spawn) to its own worker's deque.
+ ****/
+
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+class ThreadPool {
+private:
+  // One worker's tasks
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<int> tasks;
+  };
+
+  std::vector<std::thread> workers;
+  WorkQueue* queues;                  // One per worker (REFERENCE is OWNED)
+  int numWorkers;
+
+  std::mutex lock;                    // Guards stopping (and changes that wake workers)
+  std::condition_variable wake;       // Signalled when tasks are queued (or the pool stops)
+  std::condition_variable done;       // Signalled when a job's last task finishes
+  bool stopping;
+
+  std::function<void(int)> task;      // The current job
+  std::atomic<int> pending;           // Tasks of the current job not yet finished
+  std::atomic<int> queued;            // Tasks sitting in the deques
+
+  // Index of the worker running on this thread (-1 if not a worker)
+  static int& workerIndex() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  // The pool is shared by reference - no copies
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  /***
+   * takeTask:
+   *    Get the next task for worker w: from the back of its own deque,
+   *    otherwise stolen from the front of another one's.
+   *    Returns false if every deque is empty.
+   ***/
+  bool takeTask(int w, int& t) {
+    {
+      std::lock_guard<std::mutex> guard(queues[w].lock);
+      if (!queues[w].tasks.empty()) {
+	t = queues[w].tasks.back();
+	queues[w].tasks.pop_back();
+	queued--;
+	return true;
+      }
+    }
+    for (int i = 1; i < numWorkers; i++) {
+      WorkQueue& victim = queues[(w + i) % numWorkers];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tasks.empty()) {
+	t = victim.tasks.front();
+	victim.tasks.pop_front();
+	queued--;
+	return true;
+      }
+    }
+    return false;
+  }
+
+  /***
+   * workerLoop:
+   *    Body of worker w: sleep until there are tasks, run tasks until
+   *    none are left anywhere, repeat until the pool stops.
+   ***/
+  void workerLoop(int w) {
+    workerIndex() = w;
+    while (true) {
+      {
+	std::unique_lock<std::mutex> guard(lock);
+	wake.wait(guard, [&] { return stopping || queued > 0; });
+	if (stopping) return;
+      }
+
+      int t;
+      while (takeTask(w, t)) {
+	task(t);
+	if (--pending == 0) {
+	  std::lock_guard<std::mutex> guard(lock);
+	  done.notify_all();
+	}
+      }
+    }
+  }
+
+public:
+  /***
+   * Start a pool of the given number of worker threads (at least 1)
+   ***/
+  ThreadPool(int threads) : numWorkers(threads < 1 ? 1 : threads),
+			    stopping(false), pending(0), queued(0) {
+    queues = new WorkQueue[numWorkers];
+    for (int w = 0; w < numWorkers; w++) {
+      workers.push_back(std::thread(&ThreadPool::workerLoop, this, w));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+    delete[] queues;
+  }
+
+  int size() { return numWorkers; }
+
+  /***
+   * run:
+   *    Run job(i) for i = 0..count-1 on the workers and return once
+   *    they have all finished.  One job at a time.
+   ***/
+  void run(int count, std::function<void(int)> job) {
+    std::vector<int> all;
+    for (int t = 0; t < count; t++) all.push_back(t);
+    runGraph(count, all, job);
+  }
+
+  /***
+   * runGraph:
+   *    Run a job of total tasks, of which only those in ready can start
+   *    now; the rest must be spawned (once ready) by the tasks they
+   *    depend on.  Returns once all total tasks have finished.
+   ***/
+  void runGraph(int total, const std::vector<int>& ready, std::function<void(int)> job) {
+    if (total <= 0) return;
+    task = job;
+    pending = total;
+
+    // Deal the ready tasks out in contiguous chunks (neighbouring tasks share data)
+    int count = ready.size();
+    for (int w = 0; w < numWorkers; w++) {
+      int from = (long) count * w / numWorkers;
+      int to = (long) count * (w + 1) / numWorkers;
+      std::lock_guard<std::mutex> guard(queues[w].lock);
+      for (int t = from; t < to; t++) queues[w].tasks.push_back(ready[t]);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    queued += count;
+    wake.notify_all();
+    done.wait(guard, [&] { return pending == 0; });
+  }
+
+  /***
+   * spawn:
+   *    Called by a running task to add task t (now ready) to the current
+   *    job.  It goes on the back of this worker's deque, so this worker
+   *    most likely runs it next (while its inputs are still in cache).
+   ***/
+  void spawn(int t) {
+    int w = workerIndex();
+    if (w < 0 || w >= numWorkers) w = 0;
+    {
+      std::lock_guard<std::mutex> guard(queues[w].lock);
+      queues[w].tasks.push_back(t);
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    queued++;
+    wake.notify_one();
+  }
+};
+
+#endif
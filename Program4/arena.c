@@ -0,0 +1,93 @@
+/*******
+ * Arena
+ *    See arena.h for details.
+ *******/
+
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define ALIGNMENT (sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double))
+
+/***
+ * newBlock:
+ *    Allocate a block with room for at least size bytes
+ ***/
+static ArenaBlock* newBlock(size_t size) {
+  ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+  if (block == NULL) return NULL;
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/***
+ * createArena:
+ *    Create an arena whose blocks are (normally) blockSize bytes
+ *    REFERENCE returned is GIVEN
+ ***/
+Arena* createArena(size_t blockSize) {
+  Arena* ans = malloc(sizeof(Arena));
+  if (ans == NULL) return NULL;
+  ans->blockSize = blockSize;
+  ans->first = ans->current = newBlock(blockSize);
+  if (ans->first == NULL) {
+    free(ans);
+    return NULL;
+  }
+  return ans;
+}
+
+/***
+ * freeArena:
+ *    Free the arena and every block in it
+ *    REFERENCE given is STOLEN (and freed)
+ ***/
+void freeArena(Arena* arena) {
+  ArenaBlock* block = arena->first;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
+
+/***
+ * arenaAlloc:
+ *    Return size bytes of (suitably aligned) memory from the arena
+ *    or NULL if out of memory.  The memory is valid until the arena
+ *    is reset or freed.
+ ***/
+void* arenaAlloc(Arena* arena, size_t size) {
+  size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  ArenaBlock* block = arena->current;
+  while (block->used + size > block->size) {
+    // Move on to the next block (reusing one from before a reset if it fits)
+    if (block->next == NULL || block->next->size < size) {
+      ArenaBlock* fresh = newBlock(size > arena->blockSize ? size : arena->blockSize);
+      if (fresh == NULL) return NULL;
+      fresh->next = block->next;
+      block->next = fresh;
+    }
+    block = block->next;
+    block->used = 0;
+  }
+
+  arena->current = block;
+  void* ans = block->data + block->used;
+  block->used += size;
+  return ans;
+}
+
+/***
+ * resetArena:
+ *    Release everything allocated from the arena at once.
+ *    The blocks are kept for reuse.
+ ***/
+void resetArena(Arena* arena) {
+  arena->current = arena->first;
+  arena->first->used = 0;
+}
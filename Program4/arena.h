@@ -0,0 +1,33 @@
+/*******
+ * Arena
+ *    A simple bump allocator.  Memory is handed out from large blocks
+ *    and is never freed piece by piece - instead the whole arena is
+ *    reset at once (in O(1)) and its blocks are reused.
+ *    processLine uses one for everything belonging to a statement
+ *    (the Statement, its Commands and their argv arrays).
+ *******/
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+typedef struct arenaBlock {
+  struct arenaBlock* next;  // The next block (REFERENCE is OWNED)
+  size_t size;              // Bytes available in data
+  size_t used;              // Bytes handed out so far
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock* first;    // The chain of blocks (REFERENCE is OWNED)
+  ArenaBlock* current;  // The block being allocated from (REFERENCE is BORROWED)
+  size_t blockSize;     // Default size for new blocks
+} Arena;
+
+Arena* createArena(size_t blockSize);
+void freeArena(Arena* arena);
+void* arenaAlloc(Arena* arena, size_t size);
+void resetArena(Arena* arena);
+
+#endif
@@ -11,46 +11,82 @@
 #include "global.h"
 #include "varSet.h"
 #include "command.h"
+#include "pathCache.h"
+#include "lineCache.h"
+#include "statement.h"
+#include "passThrough.h"
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
-void processSet(Command* cmd);
-void processList(Command* cmd);
-void exitShell();
-void cd(Command* cmd);
-void status();
-void pwd();
+void processSet(Command* cmd, int in, FILE* out, int detached);
+void processList(Command* cmd, int in, FILE* out, int detached);
+void exitShell(Command* cmd, int in, FILE* out, int detached);
+void cd(Command* cmd, int in, FILE* out, int detached);
+void status(Command* cmd, int in, FILE* out, int detached);
+void pwd(Command* cmd, int in, FILE* out, int detached);
+void processHash(Command* cmd, int in, FILE* out, int detached);
+void processCache(Command* cmd, int in, FILE* out, int detached);
+void processWait(Command* cmd, int in, FILE* out, int detached);
+void processPass(Command* cmd, int in, FILE* out, int detached);
 
-char *builtinNames[] = { "SET", "LIST", "EXIT", "CD", "STATUS", "PWD", NULL };
-void (*builtinFn[])(Command*) = { processSet, processList, exitShell, cd, status, pwd, NULL };
+char *builtinNames[] = { "SET", "LIST", "EXIT", "CD", "STATUS", "PWD", "HASH", "CACHE", "WAIT", "PASS", NULL };
+void (*builtinFn[])(Command*, int, FILE*, int) = { processSet, processList, exitShell, cd, status, pwd, processHash, processCache, processWait, processPass, NULL };
 int currStatus = 0;
 
 /***
- * processBuiltin:
- *    Determines if the given command is a builtin and executes
- *    it if so.
- *
- *    cmd: A BORROWED reference to the command to process
- *    Returns 
+ * findBuiltin:
+ *    Returns the index of the builtin matching the command's name
+ *    or -1 if it is not a builtin.
  ***/
-int processBuiltin(Command* cmd) {
+static int findBuiltin(Command* cmd) {
   assert(cmd->command != NULL);
 
   int i;
   for (i = 0; builtinNames[i] != NULL; i++) {
     // Does the given command match the builtin string name
     if (strcasecmp(cmd->command, builtinNames[i]) == 0) {
-      // If so, execute the processing function for that command
-      (builtinFn[i])(cmd);
-      return 1;    // And return  1 (found builtin)
+      return i;
     }
   }
-  
-  return 0; // Did not find any builtin... execute normally
+  return -1;
+}
+
+/***
+ * isBuiltin:
+ *    Returns 1 if the given command is a builtin (without running it)
+ ***/
+int isBuiltin(Command* cmd) {
+  return findBuiltin(cmd) != -1;
+}
+
+/***
+ * processBuiltin:
+ *    Determines if the given command is a builtin and executes
+ *    it if so.
+ *
+ *    cmd: A BORROWED reference to the command to process
+ *    in: Its input (only PASS reads it)
+ *    out: Where its output goes (BORROWED)
+ *    detached: 1 if it runs as one stage of a pipeline.  Like a command
+ *       in a child process it then cannot change the shell: SET, CD,
+ *       EXIT, STATUS, HASH -r and CACHE -r only report any errors.
+ *    Returns 1 if it was a builtin, 0 otherwise
+ ***/
+int processBuiltin(Command* cmd, int in, FILE* out, int detached) {
+  int i = findBuiltin(cmd);
+  if (i == -1) {
+    return 0; // Did not find any builtin... execute normally
+  }
+
+  // Execute the processing function for that command
+  (builtinFn[i])(cmd, in, out, detached);
+  return 1;    // And return  1 (found builtin)
 }
 
 /***
@@ -61,31 +97,16 @@ int processBuiltin(Command* cmd) {
  *   If Arg1 is empty - the command does nothing
  *   If Arg2 is empty - the command sets the variable to an empty string ""
  ***/
-void processSet(Command* cmd) {
+void processSet(Command* cmd, int in, FILE* out, int detached) {
   assert(cmd != NULL);
-  if (cmd->head == NULL) {
-    return;    // No argument... do nothing
+  if (cmd->argc < 2 || detached) {
+    return;    // No argument (or not the shell's own SET)... do nothing
   }
-  if (*(cmd->tail->arg) == '$') {
-    char* tailCopy = malloc(sizeof(cmd->tail->arg)+1); // copy cmd->tail->arg into tailCopy because it's less awkward to deal with
-    char tempStr[100];
-    int i = 0;
-    strcpy(tailCopy, cmd->tail->arg);
-    tailCopy++; // Skip over the first $
-    while (*tailCopy != '$') { // parse the name of the variable we're looking for WITHOUT $
-      tempStr[i] = *tailCopy;
-      tailCopy++; i++;
-    }
-    tempStr[i] = '\0'; // fixes a strange error in which garbage characters were being included with tempStr
-    if (findInSet(varList, tempStr) == NULL) {
-      printf("Error - unknown variable: %s\n", tempStr);
-      return;
-    }
-    char* valueOfTempStr = findInSet(varList, tempStr)->value;
-    // ^^^ tempStr is just a name, we need to extract the VALUE from the variable referred to by that name
-    addToSet(varList, cmd->head->arg, valueOfTempStr);
-  } else {
-    addToSet(varList, cmd->head->arg, cmd->head->next == NULL ? "" : cmd->head->next->arg);
+  // Variables in the value were already substituted (unless single quoted)
+  addToSet(varList, cmd->argv[1], cmd->argc < 3 ? "" : cmd->argv[2]);
+
+  if (strcmp(cmd->argv[1], "PATH") == 0) {
+    clearCommandCache();   // Cached command paths may no longer be right
   }
 }
 
@@ -93,55 +114,118 @@ void processSet(Command* cmd) {
  * processList:
  *    List the variables and their values in the current shell
  ***/
-void processList(Command* cmd) {
-  printSet(varList, stdout);
-  fflush(stdout);
+void processList(Command* cmd, int in, FILE* out, int detached) {
+  printSet(varList, out);
+  fflush(out);
 }
 
 /***
 * exitShell:
 *   Exits the shell on the "EXIT" command
 ***/
-void exitShell() {
-	exit(0);
+void exitShell(Command* cmd, int in, FILE* out, int detached) {
+	if (!detached) exit(0);
 }
 
 /***
 * cd: Changes the working directory to the directory specified by the user
 * as the first argument to the cd command
 * If no argument is given, the working directory is changed to $HOME
+* (In a pipeline it cannot move the shell - it just checks the directory)
 ***/
-void cd(Command* cmd) {
-  if (cmd->head == NULL) {
+void cd(Command* cmd, int in, FILE* out, int detached) {
+  if (detached) {
+    struct stat info;
+    if (cmd->argc >= 2 && (stat(cmd->argv[1], &info) == -1 || !S_ISDIR(info.st_mode))) {
+      fprintf(stderr, "Error: directory %s does not exist\n", cmd->argv[1]);
+    }
+  } else if (cmd->argc < 2) {
     if (getenv("HOME") != NULL) {
       chdir(getenv("HOME"));
     } else {
       chdir("/");
     }
   } else {
-    chdir(cmd->head->arg); // Attempt to change directory...
-    if (errno != 0) {
-      fprintf(stderr, "Error: directory %s does not exist\n", cmd->head->arg); // print to stderr
-      errno = 0; // reset errno so we don't incorrectly report an error if the next directory is valid
+    // Attempt to change directory... (errno may be left over from elsewhere, so check the result)
+    if (chdir(cmd->argv[1]) == -1) {
+      fprintf(stderr, "Error: directory %s does not exist\n", cmd->argv[1]); // print to stderr
     }
   }
 }
 
 /***
 * status: turns on (1) or off (0) the report of exit status of any statement
+*   (along with what it cost - see executeStatement)
+*   STATUS ON / STATUS OFF set it, STATUS alone toggles it
 ***/
-void status() {
-  if (currStatus == 0) { currStatus = 1; }
-  else if (currStatus == 1) { currStatus = 0; }
-  printf("status: %d\n", currStatus);
+void status(Command* cmd, int in, FILE* out, int detached) {
+  if (detached) return;
+  if (cmd->argc > 1 && strcasecmp(cmd->argv[1], "ON") == 0) { currStatus = 1; }
+  else if (cmd->argc > 1 && strcasecmp(cmd->argv[1], "OFF") == 0) { currStatus = 0; }
+  else { currStatus = !currStatus; }
 }
 
 /***
 * pwd is not required for the assignment, but I thought it would be a useful function to have
 ***/
-void pwd() {
+void pwd(Command* cmd, int in, FILE* out, int detached) {
   char* cwd;
   char buff[100];
   cwd = getcwd(buff, 100);
-  printf("%s\n", cwd);
+  fprintf(out, "%s\n", cwd);
+  fflush(out);
+}
+
+/***
+* processHash: lists the cached command paths (name: path)
+*   HASH -r forgets them all
+***/
+void processHash(Command* cmd, int in, FILE* out, int detached) {
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-r") == 0) {
+    if (!detached) clearCommandCache();
+  } else {
+    printCommandCache(out);
+    fflush(out);
+  }
+}
+
+/***
+* processCache: reports the hit/miss counters of the compiled line cache
+*   CACHE -r empties the cache (and resets the counters)
+***/
+void processCache(Command* cmd, int in, FILE* out, int detached) {
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-r") == 0) {
+    if (!detached) clearLineCache();
+  } else {
+    printLineCacheStats(out);
+    fflush(out);
+  }
+}
+
+/***
+* processWait: waits until every background job (statement ended by &)
+*   has finished.  (In a pipeline it has no jobs of its own to wait for.)
+***/
+void processWait(Command* cmd, int in, FILE* out, int detached) {
+  if (!detached) waitForJobs();
+}
+
+/***
+* processPass: PASS [file] copies its input to its output - a cat stage
+*   that costs no process and, between pipes, moves the data with
+*   splice instead of copying it through user space.  Given a file, it
+*   also keeps a copy of everything there (like tee).
+***/
+void processPass(Command* cmd, int in, FILE* out, int detached) {
+  int copy = -1;
+  if (cmd->argc > 1 && (copy = open(cmd->argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    fprintf(stderr, "Error: cannot open %s: %s\n", cmd->argv[1], strerror(errno));
+    return;
+  }
+
+  fflush(out);   // Anything already written goes first
+  if (passThrough(in, fileno(out), copy) == -1 && errno != EPIPE) {
+    fprintf(stderr, "Error: PASS: %s\n", strerror(errno));
+  }
+  if (copy != -1) close(copy);
 }
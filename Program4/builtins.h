@@ -16,6 +16,7 @@
 #include "command.h"
 #include <stdio.h>
 
-int processBuiltin(Command* cmd);
+int isBuiltin(Command* cmd);
+int processBuiltin(Command* cmd, int in, FILE* out, int detached);
 
 #endif
@@ -8,6 +8,7 @@
 #include "command.h"
 #include "global.h"
 #include "builtins.h"
+#include "pathCache.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
@@ -16,41 +17,35 @@
 #include <sys/wait.h>
 #include <errno.h>
 
+#define INITIAL_ARGV_SIZE 8
+
 /*** 
  * newCommand:
- *   Create a new command using given string
+ *   Create a new command using given string (allocated from arena)
  *   Creates a null list of arguments
- *   REFERENCE returned is GIVEN
+ *   REFERENCE returned is GIVEN (until the arena is reset),
+ *   cmd is BORROWED (and kept - not copied)
+ *   Returns NULL if out of memory.
  ***/
-Command* newCommand(const char* cmd) {
-  Command* ans = malloc(sizeof(Command));
-  ans->command = strdup(cmd);
-  ans->head = NULL;
-  ans->tail = NULL;
+Command* newCommand(Arena* arena, char* cmd) {
+  Command* ans = arenaAlloc(arena, sizeof(Command));
+  char** argv = arenaAlloc(arena, INITIAL_ARGV_SIZE * sizeof(char*));
+  if (ans == NULL || argv == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.  Command not added.\n");
+    return NULL;
+  }
+  ans->command = cmd;
+  ans->argv = argv;
+  ans->argv[0] = cmd;
+  ans->argv[1] = NULL;
+  ans->argc = 1;
+  ans->argvSize = INITIAL_ARGV_SIZE;
   ans->input = STDIN;    // By default
   ans->output = STDOUT;  // By default
+  ans->inFile = ans->outFile = NULL;
   return ans;
 }
 
-/***
- * freeCommand:
- *   Frees up the given command - and its argument list
- *   REFERENCE given is STOLEN (and freed)
- ***/
-void freeCommand(Command* cmd) {
-  free(cmd->command);
-  
-  ArgList* head = cmd->head;
-  while (head != NULL) {
-    ArgList* next = head->next;  // Just in case ref. is lost
-    free(head->arg);
-    free(head);
-    head = next;
-  }
-  
-  free(cmd);
-}
-
 /***
  * printCommand:
  *    Print out the details of the given command
@@ -63,15 +58,19 @@ void printCommand(Command* cmd, FILE* stream) {
   }
   
   fprintf(stream, "Executing Command: %s\n", cmd->command);
-  fprintf(stream, "...Input: %s\n", (cmd->input == STDIN ? "STDIN" : "PIPE"));
-  fprintf(stream, "...Output: %s\n", (cmd->output == STDOUT ? "STDOUT" : "PIPE"));
+  if (cmd->input == FILE_IN) fprintf(stream, "...Input: < %s\n", cmd->inFile);
+  else fprintf(stream, "...Input: %s\n", (cmd->input == STDIN ? "STDIN" : "PIPE"));
+  if (cmd->output == FILE_OUT || cmd->output == FILE_APPEND) {
+    fprintf(stream, "...Output: %s %s\n", cmd->output == FILE_OUT ? ">" : ">>", cmd->outFile);
+  } else {
+    fprintf(stream, "...Output: %s\n", (cmd->output == STDOUT ? "STDOUT" : "PIPE"));
+  }
 
-  if (cmd->head != NULL) {
+  if (cmd->argc > 1) {
     // Print out the argument list
     int a;
-    ArgList* curr = cmd->head;
-    for (a = 1; curr != NULL; a++, curr=curr->next) {
-      fprintf(stream, "...Arg %d: %s\n", a, curr->arg);
+    for (a = 1; a < cmd->argc; a++) {
+      fprintf(stream, "...Arg %d: %s\n", a, cmd->argv[a]);
     }
   } else {
     fprintf(stream, "...No arguments\n");
@@ -79,46 +78,53 @@ void printCommand(Command* cmd, FILE* stream) {
 }
 
 /***
- * processCommand:
- *    Process the command.
- *    Execute the commands
- *       Some are via exec
- *       Otherwise process certain builtin commands.
+ * executeCommand:
+ *    Run the command in the current (child) process.
+ *    Its stdin/stdout must already be hooked up to any pipes.
+ *    A builtin is processed here, anything else is exec'd.
+ *    Never returns.
  *    REFERENCEs are BORROWED
  ***/
-void processCommand(Command* cmd) {
+void executeCommand(Command* cmd) {
   assert(cmd != NULL);
 
-  if (!processBuiltin(cmd)) {
-    // It was not a built-in so execute normally (ok, for now we just print it)
-    printCommand(cmd, stdout);
-    //execl("/bin/ls", "/bin/ls", (char *) 0);
+  if (processBuiltin(cmd, STDIN_FILENO, stdout, 1)) {
+    fflush(stdout);
+    _exit(0);
   }
+
+  char* path = findCommand(cmd->argv[0]);
+  if (path != NULL) {
+    execv(path, cmd->argv);
+  } else {
+    errno = ENOENT;
+  }
+
+  // Only get here if the exec failed
+  fprintf(stderr, ">> Error: %s\n", strerror(errno));
+  _exit(2);
 }
 
 /***
  * addArg:
- *    Add a new argument to the command
- *    REFERENCEs are BORROWED
+ *    Add a new argument to the end of the command's argv
+ *    (growing argv in the arena when it is full)
+ *    REFERENCEs are BORROWED (arg is kept - not copied)
  ***/
-void addArg(Command* cmd, const char* arg) {
-  // Allocate memory (be sure to check for Out-of-mem)
-  ArgList* newArg = malloc(sizeof(ArgList));
-
-  if (newArg == NULL) {
-    fprintf(stderr, ">> Error: Out of memory.  Token not added.\n");
-    return;
+void addArg(Arena* arena, Command* cmd, char* arg) {
+  // Room for the new argument and the NULL terminator?
+  if (cmd->argc + 2 > cmd->argvSize) {
+    int newSize = cmd->argvSize * 2;
+    char** bigger = arenaAlloc(arena, newSize * sizeof(char*));
+    if (bigger == NULL) {
+      fprintf(stderr, ">> Error: Out of memory.  Token not added.\n");
+      return;
+    }
+    memcpy(bigger, cmd->argv, cmd->argc * sizeof(char*));
+    cmd->argv = bigger;
+    cmd->argvSize = newSize;
   }
-    
-  // Store the contents (the new argument)
-  newArg->arg = strdup(arg);
-  newArg->next = NULL;
 
-  // Insert into the arglist - at the tail (if not empty)
-  if (cmd->head == NULL) {
-    // First argument
-    cmd->head = cmd->tail = newArg;
-  } else {
-    cmd->tail = cmd->tail->next = newArg;
-  }
+  cmd->argv[cmd->argc++] = arg;
+  cmd->argv[cmd->argc] = NULL;
 }
@@ -9,25 +9,28 @@
 #define __COMMAND_H
 
 #include <stdio.h>
+#include "arena.h"
 
-typedef struct argList {
-  char* arg;             // The argument string (REFERENCE is OWNED)
-  struct argList* next;  // The next in the list (REFERENCE is OWNED)
-} ArgList;
-
+/***
+ * A Command and its argv array live in the statement's Arena, so there
+ * is nothing to free one by one.  The command name and argument strings
+ * are NOT copied - they point into the tokenized line, which must
+ * outlive the command.
+ ***/
 typedef struct {
-  char* command;  // The command name itself (REFERENCE is OWNED)
-  ArgList* head;  // The head of the argument list (REFERENCE is OWNED)
-  ArgList* tail;  // The tail of the argument list (REFERENCE is BORROWED - part of head's list)
-  enum { STDIN, PIPE_IN } input;  // Identifies whether command gets input from stdin or a pipe
-  enum { STDOUT, PIPE_OUT } output;  // Identifies whether command sends output to stdout or a pipe
+  char* command;  // The command name itself (REFERENCE is BORROWED)
+  char** argv;    // command, then the arguments, then NULL - ready for exec (in the arena)
+  int argc;       // Number of entries in argv (not counting the NULL)
+  int argvSize;   // Allocated size of argv
+  enum { STDIN, PIPE_IN, FILE_IN } input;  // Identifies whether command gets input from stdin, a pipe or a file (<)
+  enum { STDOUT, PIPE_OUT, FILE_OUT, FILE_APPEND } output;  // ... sends output to stdout, a pipe or a file (> or >>)
+  char* inFile;   // The file for FILE_IN (REFERENCE is BORROWED)
+  char* outFile;  // The file for FILE_OUT/FILE_APPEND (REFERENCE is BORROWED)
 } Command;
 
-Command* newCommand(const char* cmd);
-void freeCommand(Command* cmd);
+Command* newCommand(Arena* arena, char* cmd);
 void printCommand(Command* cmd, FILE* stream);
-void processCommand(Command* cmd);
 void executeCommand(Command* cmd);
-void addArg(Command* cmd, const char* arg);
+void addArg(Arena* arena, Command* cmd, char* arg);
 
 #endif
@@ -13,5 +13,6 @@
 // These variables must be defined elsewhere
 //    these are just declarations
 extern VarSet* varList;
+extern int currStatus;   // 1 if the exit status (and cost) of each statement is reported
 
 #endif
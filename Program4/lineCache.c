@@ -0,0 +1,381 @@
+/*******
+ * LineCache
+ *    See lineCache.h for details.
+ *******/
+
+#include "lineCache.h"
+#include "tokenizer.h"
+#include "arena.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUCKETS (2 * LINE_CACHE_SIZE)   // Power of 2
+#define SEEN (4 * LINE_CACHE_SIZE)      // Power of 2
+
+static CompiledLine* buckets[BUCKETS];
+static CompiledLine* newest = NULL;     // LRU list ends
+static CompiledLine* oldest = NULL;
+static CompiledLine* inUse = NULL;      // The line being run (never freed by a clear)
+static int cached = 0;
+static long hits = 0;
+static long misses = 0;
+static long once = 0;                   // Misses run without being cached
+
+// Hashes of lines missed once (a line is only cached when it comes back)
+static unsigned int seen[SEEN];
+
+// Holds the copy being tokenized, and all of a line run without caching
+// (reset for each miss, so one-off lines cost no malloc or free)
+static Arena* scratch = NULL;
+
+/***
+ * hashLine:
+ *    FNV-1a hash of len characters of line
+ ***/
+static unsigned int hashLine(const char* line, size_t len) {
+  unsigned int h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) line[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/***
+ * grow:
+ *    Make room for one more item in an array (of itemSize items)
+ *    allocated from arena, doubling it (and copying) when full.
+ *    Returns 0 if out of memory.
+ ***/
+static int grow(Arena* arena, void** items, int count, int* capacity, size_t itemSize) {
+  if (count < *capacity) return 1;
+
+  int newCapacity = (*capacity == 0) ? 4 : *capacity * 2;
+  void* bigger = arenaAlloc(arena, newCapacity * itemSize);
+  if (bigger == NULL) return 0;
+  if (count > 0) memcpy(bigger, *items, count * itemSize);
+  *items = bigger;
+  *capacity = newCapacity;
+  return 1;
+}
+
+/***
+ * setToken:
+ *    Fill in a token template from a word token of the line, copying
+ *    its text into arena (or pointing at it in place if arena is NULL).
+ *    Returns 0 if out of memory.
+ ***/
+static int setToken(Arena* arena, TokenTemplate* token, aToken* answer) {
+  token->text = answer->start;
+  if (arena != NULL) {
+    token->text = arenaAlloc(arena, answer->length + 1);
+    if (token->text == NULL) return 0;
+    memcpy(token->text, answer->start, answer->length);
+    token->text[answer->length] = '\0';
+  }
+  token->length = answer->length;
+  // Variables are substituted at run time (never inside single quotes)
+  token->substitute = (answer->type != SINGLE_QUOTE &&
+		       memchr(answer->start, '$', answer->length) != NULL);
+  return 1;
+}
+
+/***
+ * compileLine:
+ *    Tokenize and parse a scratch copy of line (len characters) into a
+ *    CompiledLine.  If keep is set it gets its own arena, holding the
+ *    line once (as its key) and the token texts, so it can be cached;
+ *    otherwise it lives in the scratch arena until the next miss.
+ *    Parse errors are recorded in the compiled line (statements before
+ *    the error still run, as before).
+ *    Returns NULL if out of memory.
+ *    REFERENCE returned is GIVEN if keep is set, BORROWED otherwise
+ ***/
+static CompiledLine* compileLine(const char* line, size_t len, unsigned int hash, int keep) {
+  enum { CMD, PIPED_CMD, ARGS } processMode ;
+  processMode = CMD;
+  int doneFlag = 0;
+
+  if (scratch == NULL) scratch = createArena(4096);
+  if (scratch == NULL) return NULL;
+  resetArena(scratch);
+
+  Arena* arena = keep ? createArena(2 * len + 256) : scratch;
+  if (arena == NULL) return NULL;
+  Arena* copyTo = keep ? arena : NULL;   // Where token texts go (NULL: left in place)
+
+  CompiledLine* ans = arenaAlloc(arena, sizeof(CompiledLine));
+  char* key = keep ? arenaAlloc(arena, len + 1) : NULL;
+  char* text = arenaAlloc(scratch, len + 1);
+  if (ans == NULL || (keep && key == NULL) || text == NULL) {
+    if (keep) freeArena(arena);
+    return NULL;
+  }
+  if (keep) {
+    memcpy(key, line, len);
+    key[len] = '\0';
+  }
+  memcpy(text, line, len);
+  text[len] = '\0';
+  ans->arena = arena;
+  ans->key = key;
+  ans->keyLength = len;
+  ans->hash = hash;
+  ans->statements = NULL;
+  ans->count = ans->capacity = 0;
+  ans->error = NULL;
+
+  StatementTemplate* stmt = NULL;   // Statement being built
+  StageTemplate* stage = NULL;      // Stage being built
+
+  // Tokens are cut out of the scratch copy (and copied out if kept)
+  startTokenInPlace(text);
+  aToken answer;
+
+  int redirect = 0;   // The <, > or >> still waiting for its file name (0 if none)
+
+  answer = getNextToken();
+  while (!doneFlag) {
+    if (redirect != 0 && answer.type != BASIC && answer.type != DOUBLE_QUOTE &&
+	answer.type != SINGLE_QUOTE && answer.type != ERROR) {
+      ans->error = "Error: Missing file name\n";
+      ans->count--;   // Drop the unfinished statement
+      return ans;
+    }
+
+    switch (answer.type) {
+    case ERROR:
+      // Error (for some reason)
+      ans->error = "Error parsing line.\n";
+      if (processMode != CMD) ans->count--;   // Drop the unfinished statement
+      return ans;
+
+    case BASIC:
+    case DOUBLE_QUOTE:
+    case SINGLE_QUOTE:
+      if (redirect != 0) {
+	// The file name of a redirection (replacing any earlier one)
+	assert(stage != NULL);
+	if (!setToken(copyTo, redirect == REDIRECT_IN ? &stage->input : &stage->output, &answer)) {
+	  if (keep) freeArena(arena);
+	  return NULL;
+	}
+	if (redirect != REDIRECT_IN) stage->append = (redirect == REDIRECT_APPEND);
+	redirect = 0;
+	break;
+      }
+      if (processMode == CMD) {
+	// This is a new statement (and a new command)
+	if (!grow(arena, (void**) &ans->statements, ans->count, &ans->capacity, sizeof(StatementTemplate))) {
+	  if (keep) freeArena(arena);
+	  return NULL;
+	}
+	stmt = &ans->statements[ans->count++];
+	stmt->stages = NULL;
+	stmt->count = stmt->capacity = 0;
+	stmt->background = 0;
+      }
+      if (processMode == CMD || processMode == PIPED_CMD) {
+	// This is a new command
+	assert(stmt != NULL);
+	if (!grow(arena, (void**) &stmt->stages, stmt->count, &stmt->capacity, sizeof(StageTemplate))) {
+	  if (keep) freeArena(arena);
+	  return NULL;
+	}
+	stage = &stmt->stages[stmt->count++];
+	stage->tokens = NULL;
+	stage->count = stage->capacity = 0;
+	stage->input.text = stage->output.text = NULL;
+	stage->append = 0;
+	processMode = ARGS;  // Switch modes
+      }
+
+      // The command name or a new argument
+      assert(stage != NULL);
+      if (!grow(arena, (void**) &stage->tokens, stage->count, &stage->capacity, sizeof(TokenTemplate))) {
+	if (keep) freeArena(arena);
+	return NULL;
+      }
+      if (!setToken(copyTo, &stage->tokens[stage->count++], &answer)) {
+	if (keep) freeArena(arena);
+	return NULL;
+      }
+      break;
+
+    case REDIRECT_IN:
+    case REDIRECT_OUT:
+    case REDIRECT_APPEND:
+      // A redirection of the current command - its file name comes next
+      if (processMode != ARGS) {
+	ans->error = "Error: Missing command\n";
+	if (processMode == PIPED_CMD) ans->count--;   // Drop the broken statement
+	return ans;
+      }
+      redirect = answer.type;
+      break;
+
+    case PIPE:
+      // We have a pipe, so the command is now completed
+      if (processMode == CMD || processMode == PIPED_CMD) {
+	// A pipe while waiting for a command!
+	// Empty (blank) statements for pipes are not allowed
+	ans->error = "Error: Missing command\n";
+	if (processMode == PIPED_CMD) ans->count--;   // Drop the broken statement
+	return ans;
+      }
+      processMode = PIPED_CMD;  // Next command uses a piped command
+      break;
+
+    case EOL:
+      // EOL is nearly same as SEMICOLON - just flag done as well
+      doneFlag = 1;
+
+    case COMMENT:
+      doneFlag = 1; // Comment - we don't need to pay any attention to it
+      
+    case SEMICOLON:
+      // We have a statement terminator
+      if (processMode == PIPED_CMD) {
+	// We are in a piped command mode (without having gotten any new command)
+	// An empty statement - not allowed after a pipe
+	ans->error = "Error: Broken pipe\n";
+	ans->count--;   // Drop the broken statement
+	return ans;
+      }
+      // An empty statement (CMD) is allowed but ignored
+      processMode = CMD;  // Switch back to processing mode
+      break;
+
+    case AMPERSAND:
+      // Also a statement terminator - but the statement runs in the background
+      if (processMode != ARGS) {
+	// Nothing (or a dangling pipe) to put in the background
+	ans->error = (processMode == CMD) ? "Error: Missing command\n" : "Error: Broken pipe\n";
+	if (processMode == PIPED_CMD) ans->count--;   // Drop the broken statement
+	return ans;
+      }
+      stmt->background = 1;
+      processMode = CMD;
+      break;
+
+    default:
+      ans->error = "Programming Error: Unrecognized type returned!!!\n";
+      if (processMode != CMD) ans->count--;   // Drop the unfinished statement
+      return ans;
+    }
+    answer = getNextToken();
+  }
+
+  return ans;
+}
+
+/***
+ * unlinkLine:
+ *    Take a line out of the LRU order
+ ***/
+static void unlinkLine(CompiledLine* entry) {
+  if (entry->newer != NULL) entry->newer->older = entry->older;
+  else newest = entry->older;
+  if (entry->older != NULL) entry->older->newer = entry->newer;
+  else oldest = entry->newer;
+}
+
+/***
+ * makeNewest:
+ *    Put a line at the front of the LRU order
+ ***/
+static void makeNewest(CompiledLine* entry) {
+  entry->newer = NULL;
+  entry->older = newest;
+  if (newest != NULL) newest->newer = entry;
+  newest = entry;
+  if (oldest == NULL) oldest = entry;
+}
+
+/***
+ * removeLine:
+ *    Remove a line from the cache and free it
+ ***/
+static void removeLine(CompiledLine* entry) {
+  CompiledLine** link = &buckets[entry->hash & (BUCKETS - 1)];
+  while (*link != entry) link = &(*link)->hashNext;
+  *link = entry->hashNext;
+
+  unlinkLine(entry);
+  cached--;
+  freeArena(entry->arena);   // The entry itself lives in its arena
+}
+
+/***
+ * getCompiledLine:
+ *    Return the compiled form of line (len characters - it need not be
+ *    null-terminated, or writable), compiling it if it is not already
+ *    in the cache.  A hit never copies the line.  A missed line is only cached the second
+ *    time it is seen, so scripts of one-off lines do not churn the cache.
+ *    Returns NULL if out of memory.
+ *    REFERENCE returned is BORROWED - valid until the next call.
+ ***/
+CompiledLine* getCompiledLine(const char* line, size_t len) {
+  unsigned int h = hashLine(line, len);
+
+  CompiledLine* entry;
+  for (entry = buckets[h & (BUCKETS - 1)]; entry != NULL; entry = entry->hashNext) {
+    if (entry->hash == h && entry->keyLength == len && memcmp(entry->key, line, len) == 0) {
+      // Hit - it is now the most recently used
+      hits++;
+      unlinkLine(entry);
+      makeNewest(entry);
+      return inUse = entry;
+    }
+  }
+
+  misses++;
+  unsigned int* slot = &seen[h & (SEEN - 1)];
+  if (*slot != h) {
+    // First time (as far as we know) - run it from scratch, uncached
+    *slot = h;
+    once++;
+    return inUse = compileLine(line, len, h, 0);
+  }
+
+  entry = compileLine(line, len, h, 1);
+  if (entry == NULL) return inUse = NULL;
+
+  // Make room (dropping the least recently used)
+  if (cached >= LINE_CACHE_SIZE) removeLine(oldest);
+
+  entry->hashNext = buckets[h & (BUCKETS - 1)];
+  buckets[h & (BUCKETS - 1)] = entry;
+  makeNewest(entry);
+  cached++;
+  return inUse = entry;
+}
+
+/***
+ * clearLineCache:
+ *    Throw out every cached line (except one that is running right now)
+ *    and reset the counters.
+ ***/
+void clearLineCache() {
+  CompiledLine* entry = oldest;
+  while (entry != NULL) {
+    CompiledLine* next = entry->newer;
+    if (entry != inUse) removeLine(entry);
+    entry = next;
+  }
+  memset(seen, 0, sizeof(seen));
+  hits = misses = once = 0;
+}
+
+/***
+ * printLineCacheStats:
+ *    Print the cache's hit/miss counters
+ ***/
+void printLineCacheStats(FILE* stream) {
+  fprintf(stream, "hits: %ld\n", hits);
+  fprintf(stream, "misses: %ld (%ld seen once, not cached)\n", misses, once);
+  fprintf(stream, "lines: %d/%d\n", cached, LINE_CACHE_SIZE);
+}
@@ -0,0 +1,67 @@
+/*******
+ * LineCache
+ *    Scripts run the same lines over and over (loop bodies...), so a
+ *    line is only tokenized and parsed once.  The parsed ("compiled")
+ *    form is kept in a cache keyed by the raw line text:
+ *       a list of statements, each a list of pipe stages, each a list
+ *       of token templates (command name then arguments).
+ *    Tokens that still need variable substitution are marked as slots;
+ *    only those are redone each time the line runs.
+ *
+ *    The cache holds at most LINE_CACHE_SIZE lines and throws out the
+ *    least recently used line when it is full.  A line only goes in the
+ *    second time it is seen; until then it is compiled in a scratch
+ *    arena that is reused for the next one-off line.
+ *******/
+
+#ifndef __LINE_CACHE_H
+#define __LINE_CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "arena.h"
+
+#define LINE_CACHE_SIZE 256
+
+typedef struct {
+  char* text;       // The token text (null-terminated, in the line's arena)
+  size_t length;
+  int substitute;   // 1 if it is a slot: $name$ must be substituted each run
+} TokenTemplate;
+
+typedef struct {
+  TokenTemplate* tokens;  // The command name then its arguments
+  int count;
+  int capacity;
+  TokenTemplate input;    // File after <  (text is NULL if none)
+  TokenTemplate output;   // File after > or >>  (text is NULL if none)
+  int append;             // 1 if output was given by >>
+} StageTemplate;
+
+typedef struct {
+  StageTemplate* stages;  // The pipe stages in order
+  int count;
+  int capacity;
+  int background;         // 1 if it ended with & (runs as a job, without waiting)
+} StatementTemplate;
+
+typedef struct compiledLine {
+  Arena* arena;                    // Holds everything for this line (REFERENCE is OWNED,
+                                   //   except for an uncached line: the scratch arena)
+  char* key;                       // The raw line text (in arena; NULL if not cached)
+  size_t keyLength;
+  unsigned int hash;
+  StatementTemplate* statements;   // The non-empty statements in order (in arena)
+  int count;
+  int capacity;
+  const char* error;               // Error to report after the statements run (or NULL)
+  struct compiledLine* hashNext;   // Next in the same hash bucket (REFERENCE is BORROWED)
+  struct compiledLine* newer;      // LRU order (REFERENCEs are BORROWED)
+  struct compiledLine* older;
+} CompiledLine;
+
+CompiledLine* getCompiledLine(const char* line, size_t len);
+void clearLineCache();
+void printLineCacheStats(FILE* stream);
+
+#endif
@@ -0,0 +1,110 @@
+/*******
+ * PassThrough
+ *    See passThrough.h for details.
+ *******/
+
+#define _GNU_SOURCE   // For splice and tee
+#include "passThrough.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/***
+ * writeAll:
+ *    Write all len bytes of buffer to fd.  Returns 0 on success, -1 on error.
+ ***/
+static int writeAll(int fd, char* buffer, size_t len) {
+  while (len > 0) {
+    ssize_t put = write(fd, buffer, len);
+    if (put == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buffer += put;
+    len -= put;
+  }
+  return 0;
+}
+
+/***
+ * spliceAll:
+ *    Move exactly len bytes (already waiting in pipe in) to fd out.
+ *    Returns 0 on success, -1 on error.
+ ***/
+static int spliceAll(int in, int out, size_t len) {
+  while (len > 0) {
+    ssize_t moved = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+    if (moved == -1 && errno == EINTR) continue;
+    if (moved <= 0) return -1;
+    len -= moved;
+  }
+  return 0;
+}
+
+/***
+ * copyThrough:
+ *    Copy in to out (and to copy, unless it is -1) with read and write
+ *    until in reaches end of file.
+ *    Returns the bytes passed on, or -1 on error (errno tells why -
+ *    EPIPE just means the reader went away).
+ ***/
+long copyThrough(int in, int out, int copy) {
+  char* buffer = malloc(PASS_CHUNK);
+  long total = 0;
+  if (buffer == NULL) return -1;
+
+  while (1) {
+    ssize_t got = read(in, buffer, PASS_CHUNK);
+    if (got == -1 && errno == EINTR) continue;
+    if (got <= 0) {
+      if (got == -1) total = -1;
+      break;
+    }
+    if (writeAll(out, buffer, got) == -1 || (copy != -1 && writeAll(copy, buffer, got) == -1)) {
+      total = -1;
+      break;
+    }
+    total += got;
+  }
+
+  free(buffer);
+  return total;
+}
+
+/***
+ * passThrough:
+ *    Same as copyThrough, but zero-copy where the kernel allows it:
+ *    splice moves pages from in to out; with a copy, tee first
+ *    duplicates them into out and splice then drains them into copy.
+ *    If the descriptors are not the kind splice/tee accept (EINVAL
+ *    before anything moved) it falls back to copyThrough.
+ ***/
+long passThrough(int in, int out, int copy) {
+  long total = 0;
+
+  while (1) {
+    ssize_t moved;
+    if (copy == -1) {
+      moved = splice(in, NULL, out, NULL, PASS_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } else {
+      moved = tee(in, out, PASS_CHUNK, 0);   // in keeps its pages...
+      if (moved > 0 && spliceAll(in, copy, moved) == -1) return -1;   // ...until they go to copy
+    }
+
+    if (moved > 0) {
+      total += moved;
+    } else if (moved == 0) {
+      return total;   // End of file
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EINVAL && total == 0) {
+      // Not a pipe (a file or terminal...) - copy the ordinary way
+      return copyThrough(in, out, copy);
+    } else {
+      return -1;
+    }
+  }
+}
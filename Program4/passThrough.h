@@ -0,0 +1,19 @@
+/*******
+ * PassThrough
+ *    Copy everything from one descriptor to another (a cat stage),
+ *    optionally keeping a copy in a third (like tee).
+ *    When the descriptors are pipes the data is moved with splice -
+ *    and duplicated with tee - so the pages go from pipe to pipe inside
+ *    the kernel without ever being copied out to user space.  Anything
+ *    else falls back to a plain read/write loop.
+ *******/
+
+#ifndef __PASS_THROUGH_H
+#define __PASS_THROUGH_H
+
+#define PASS_CHUNK (1 << 20)   // Most bytes moved by one splice/read
+
+long passThrough(int in, int out, int copy);
+long copyThrough(int in, int out, int copy);
+
+#endif
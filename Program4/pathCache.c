@@ -0,0 +1,112 @@
+/*******
+ * PathCache
+ *    See pathCache.h for details.
+ *    The cache itself is just another VarSet (name -> path).
+ *******/
+
+#include "pathCache.h"
+#include "global.h"
+#include "varSet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+static VarSet* cache = NULL;
+
+/***
+ * searchPath:
+ *    Look for an executable regular file called name in each
+ *    directory of PATH.  Returns the full path (REFERENCE is GIVEN)
+ *    or NULL if there is none.
+ ***/
+static char* searchPath(char* name) {
+  VarEntry* var = findInSet(varList, "PATH");
+  const char* path = (var != NULL) ? var->value : getenv("PATH");
+  if (path == NULL) path = DEFAULT_PATH;
+
+  size_t nameLen = strlen(name);
+  char* full = malloc(strlen(path) + nameLen + 2);
+  if (full == NULL) return NULL;
+
+  const char* dir = path;
+  while (1) {
+    const char* end = strchr(dir, ':');
+    size_t dirLen = (end != NULL) ? (size_t) (end - dir) : strlen(dir);
+
+    // An empty entry means the current directory
+    if (dirLen == 0) {
+      memcpy(full, name, nameLen + 1);
+    } else {
+      memcpy(full, dir, dirLen);
+      full[dirLen] = '/';
+      memcpy(full + dirLen + 1, name, nameLen + 1);
+    }
+
+    struct stat info;
+    if (stat(full, &info) == 0 && S_ISREG(info.st_mode) && access(full, X_OK) == 0) {
+      return full;   // Found it
+    }
+
+    if (end == NULL) break;
+    dir = end + 1;
+  }
+
+  free(full);
+  return NULL;
+}
+
+/***
+ * findCommand:
+ *    Return the path to execute for the command name.
+ *    A name containing a / is used as is.  Otherwise the cached
+ *    path is returned, searching PATH (and caching it) on a miss.
+ *    Returns NULL if the command is not found.
+ *    REFERENCE returned is BORROWED (valid until the cache changes)
+ ***/
+char* findCommand(char* name) {
+  if (strchr(name, '/') != NULL) return name;
+
+  if (cache == NULL) cache = createVarSet();
+
+  VarEntry* hit = findInSet(cache, name);
+  if (hit != NULL) return hit->value;
+
+  char* full = searchPath(name);
+  if (full == NULL) return NULL;
+
+  addToSet(cache, name, full);
+  free(full);
+  hit = findInSet(cache, name);
+  return (hit != NULL) ? hit->value : NULL;
+}
+
+/***
+ * forgetCommand:
+ *    Drop the cached path for name (e.g. the file has gone away)
+ ***/
+void forgetCommand(char* name) {
+  if (cache != NULL) removeFromSet(cache, name);
+}
+
+/***
+ * clearCommandCache:
+ *    Forget every cached path (e.g. PATH has changed)
+ ***/
+void clearCommandCache() {
+  if (cache != NULL) {
+    freeVarSet(cache);
+    cache = NULL;
+  }
+}
+
+/***
+ * printCommandCache:
+ *    List the cached commands and their paths
+ ***/
+void printCommandCache(FILE* stream) {
+  if (cache != NULL) printSet(cache, stream);
+}
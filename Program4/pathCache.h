@@ -0,0 +1,22 @@
+/*******
+ * PathCache
+ *    A "hash" table of command names to the absolute path found by
+ *    searching PATH (like bash's hash builtin), so a command that is run
+ *    repeatedly only pays for the directory search once.
+ *
+ *    PATH is the shell variable PATH if it is set, otherwise the
+ *    PATH environment variable.  The cache must be cleared whenever
+ *    PATH changes, and an entry forgotten when its path stops working.
+ *******/
+
+#ifndef __PATH_CACHE_H
+#define __PATH_CACHE_H
+
+#include <stdio.h>
+
+char* findCommand(char* name);
+void forgetCommand(char* name);
+void clearCommandCache();
+void printCommandCache(FILE* stream);
+
+#endif
@@ -0,0 +1,121 @@
+/*******
+ * Pipe throughput benchmark
+ *    Pushes a stream of bytes through a multi-stage pipeline:
+ *       producer | relay | ... | relay | consumer
+ *    (every stage its own process, as the shell would run them) and
+ *    reports GB/s.  The relays are cat stages moving the data either
+ *    with read/write (copyThrough) or with splice (passThrough, as
+ *    PASS does), and every combination is run with the default pipe
+ *    capacity and with one set by F_SETPIPE_SZ (as SET PIPESIZE does).
+ *
+ *    Usage: pipeBench [GB] [relays] [pipeBytes]   (defaults: 2 3 1048576)
+ *******/
+
+#define _GNU_SOURCE   // For F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "passThrough.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***
+ * produce:
+ *    Write total bytes (a reused 1MB buffer) to fd
+ ***/
+static void produce(int fd, long total) {
+  char* buffer = malloc(PASS_CHUNK);
+  memset(buffer, 'x', PASS_CHUNK);
+  while (total > 0) {
+    size_t len = total < PASS_CHUNK ? total : PASS_CHUNK;
+    ssize_t put = write(fd, buffer, len);
+    if (put == -1) {
+      if (errno == EINTR) continue;
+      perror("write");
+      break;
+    }
+    total -= put;
+  }
+  free(buffer);
+}
+
+/***
+ * runPipeline:
+ *    Time total bytes through relays cat stages.  The consumer (this
+ *    process) drains into /dev/null the same way the relays move data.
+ *    Returns the bytes that arrived.
+ ***/
+static long runPipeline(long total, int relays, long pipeBytes, int spliced, double* elapsed) {
+  int n = relays + 1;   // Pipes: producer->relay1->...->consumer
+  int pipes[n][2];
+  pid_t pids[n];
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    if (pipe(pipes[i]) == -1) { perror("pipe"); exit(1); }
+    if (pipeBytes > 0 && fcntl(pipes[i][0], F_SETPIPE_SZ, (int) pipeBytes) == -1) {
+      perror("F_SETPIPE_SZ");
+    }
+  }
+
+  double start = now();
+  // Stage i writes to pipe i: stage 0 is the producer, the rest relay pipe i-1
+  for (i = 0; i < n; i++) {
+    pids[i] = fork();
+    if (pids[i] == -1) { perror("fork"); exit(1); }
+    if (pids[i] == 0) {
+      for (j = 0; j < n; j++) {
+	if (j != i) close(pipes[j][1]);
+	if (j != i-1) close(pipes[j][0]);
+      }
+      if (i == 0) produce(pipes[0][1], total);
+      else if (spliced) passThrough(pipes[i-1][0], pipes[i][1], -1);
+      else copyThrough(pipes[i-1][0], pipes[i][1], -1);
+      _exit(0);
+    }
+  }
+  for (j = 0; j < n; j++) {
+    close(pipes[j][1]);
+    if (j != n-1) close(pipes[j][0]);
+  }
+
+  int sink = open("/dev/null", O_WRONLY);
+  long got = spliced ? passThrough(pipes[n-1][0], sink, -1) : copyThrough(pipes[n-1][0], sink, -1);
+  *elapsed = now() - start;
+  close(sink);
+  close(pipes[n-1][0]);
+  for (i = 0; i < n; i++) waitpid(pids[i], NULL, 0);
+  return got;
+}
+
+int main(int argc, char* argv[]) {
+  double gb = (argc > 1) ? atof(argv[1]) : 2;
+  int relays = (argc > 2) ? atoi(argv[2]) : 3;
+  long pipeBytes = (argc > 3) ? atol(argv[3]) : 1 << 20;
+  long total = (long) (gb * (1L << 30));
+  int spliced, sized;
+
+  printf("%.2f GB through %d relay stage(s)\n", gb, relays);
+  for (sized = 0; sized < 2; sized++) {
+    for (spliced = 0; spliced < 2; spliced++) {
+      double elapsed;
+      long got = runPipeline(total, relays, sized ? pipeBytes : 0, spliced, &elapsed);
+      char pipeName[32];
+      if (sized) snprintf(pipeName, sizeof(pipeName), "%ld", pipeBytes);
+      else strcpy(pipeName, "default");
+      printf("%-11s pipe %-8s %6.2f s  (%6.2f GB/s)%s\n",
+	     spliced ? "splice" : "read/write", pipeName, elapsed, got / elapsed / (1L << 30),
+	     got == total ? "" : "  SHORT");
+    }
+  }
+  return 0;
+}
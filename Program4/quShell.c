@@ -15,7 +15,10 @@
  *
  *   It also executes STATEMENTS
  *     A STATEMENT is a sequence of (zero or more) piped commands that ends with either
- *     a new line or a semicolon.
+ *     a new line or a semicolon - or an ampersand (&), which runs it in the
+ *     background: the shell goes on without waiting (see WAIT and MAXJOBS).
+ *     A command can redirect its input (< file) or output (> file, or >> file
+ *     to append); the shell opens the file and hands it to the command.
  *     The exit status of a statement is the exit status of the last
  *     command in the sequence.
  *
@@ -31,16 +34,26 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <setjmp.h>
 #include "global.h"
 #include "tokenizer.h"
 #include "varSet.h"
 #include "command.h"
+#include "statement.h"
+#include "arena.h"
+#include "subst.h"
+#include "lineCache.h"
 #include "builtins.h"
 #include "unistd.h"
 
 
-#define MAX_LINE_LENGTH 500
-#define MAX_SUBSTITUTION_LEVEL 10
+#define SCRIPT_CHUNK_SIZE (1 << 16)   // Bytes read at a time from a script that cannot be mapped
+#define ARENA_BLOCK_SIZE 4096
 
 // The set of variables in this shell.
 VarSet* varList = NULL;
@@ -49,139 +62,285 @@ VarSet* varList = NULL;
 void shellPrompt() { printf(">> "); }
 
 /***
- * processLine:
- *    line: string to process (REFERENCE is BORROWED)
+ * templateText:
+ *    The text of a token template (in arena), substituted if it needs it.
+ *    Returns NULL if out of memory.
  ***/
-void processLine(char* line) {
-  enum { CMD, PIPED_CMD, ARGS } processMode ;
-  processMode = CMD;
-  Command* cmd = NULL;
-  int doneFlag = 0;
-
-  startToken(line);
-  aToken answer;
-
-  answer = getNextToken();
-  while (!doneFlag) {
-    switch (answer.type) {
-    case ERROR:
-      // Error (for some reason)
-      fprintf(stderr, "Error parsing line.\n");
-      if (cmd != NULL) {
-	     freeCommand(cmd);
-	     cmd = NULL;
-      }
-      return;
-
-    case BASIC:
-    case DOUBLE_QUOTE:
-    case SINGLE_QUOTE:
-      if (processMode == CMD) {
-	     // This is a new command
-	assert (cmd == NULL);
-	cmd = newCommand(answer.start);
-	processMode = ARGS;  // Switch modes
-      } else if (processMode == PIPED_CMD) {
-	// This is a new command after a pipe
-	cmd = newCommand(answer.start);
-	cmd->input = PIPE_IN;
-	processMode = ARGS;        // Switch modes
-      } else if (processMode == ARGS) {
-	// This is a new argument
-	assert(cmd != NULL);
-	addArg(cmd, answer.start);
-      }
-      break;
-////// PIPE
-    case PIPE:
-      // We have a pipe, so command is now completed and ready to be executed
-      if (processMode == CMD || processMode == PIPED_CMD) {
-	// A pipe while waiting for a command!
-	// Empty (blank) statements for pipes are not allowed
-	fprintf(stderr, "Error: Missing command\n");
-	assert (cmd == NULL);  // Otherwise some programming error occurred! (Mem leak maybe?)
-	return;
+static char* templateText(Arena* arena, TokenTemplate* token) {
+  if (!token->substitute) return token->text;
+  return substitute(arena, token->text, token->length);
+}
+
+/***
+ * buildStatement:
+ *    Build the statement to run from its template (in arena),
+ *    substituting variables in the tokens that need it.
+ *    A redirected command reads/writes its file instead of a pipe.
+ *    Returns NULL if out of memory.
+ ***/
+Statement* buildStatement(Arena* arena, StatementTemplate* tmpl) {
+  Statement* stmt = newStatement(arena);
+  if (stmt == NULL) return NULL;
+  startSubstitution();
+
+  int s, t;
+  for (s = 0; s < tmpl->count; s++) {
+    StageTemplate* stage = &tmpl->stages[s];
+    Command* cmd = NULL;
+    for (t = 0; t < stage->count; t++) {
+      char* text = templateText(arena, &stage->tokens[t]);
+      if (text == NULL) return NULL;
+
+      if (t == 0) {
+	// The command itself
+	if ((cmd = newCommand(arena, text)) == NULL) return NULL;
+	if (s > 0) cmd->input = PIPE_IN;
+	if (s < tmpl->count - 1) cmd->output = PIPE_OUT;
       } else {
-	assert(cmd != NULL);       // Otherwise some prog. error - entered ARGS mode w/o a Command!
-	cmd->output = PIPE_OUT;    // Set its output stream to that of a PIPE
-	processCommand(cmd);
-	freeCommand(cmd);
-
-	/* MY ADDITIONS */
-	  int comm[2];
-	  pipe(comm); // Creates a pipe out of comm
-	  if (fork() == 0) {
-	    dup2(comm[0], 0); // Duplicates comm[0], so we can close it
-	    close(comm[0]);
-	    close(comm[1]);
-	  }
-	  dup2(comm[1], 1);
-	  close(comm[1]);
-	  close(comm[0]);
-	/* MY ADDITIONS */
-
-	cmd = NULL;
-	processMode = PIPED_CMD;  // Next command uses a piped command
+	addArg(arena, cmd, text);
       }
-      break;
-////// PIPE
-
-
-    case EOL:
-      // EOL is nearly same as SEMICOLON - just flag done as well
-      doneFlag = 1;
-
-    case COMMENT:
-      doneFlag = 1; // Comment - we don't need to pay any attention to it
-      
-    case SEMICOLON:
-      // We have a statement terminator
-      if (processMode == PIPED_CMD) {
-	// We are in a piped command mode (without having gotten any new command)
-	// An empty statement - not allowed after a pipe
-	fprintf(stderr, "Error: Broken pipe\n");
-	assert (cmd == NULL);
-	return;
-      } else if (processMode == CMD) {
-	assert (cmd == NULL);
-	// An empty statement - is allowed but ignored
-      } else {
-	assert (cmd != NULL);
-	processCommand(cmd);
-	freeCommand(cmd);
-	cmd = NULL;
+    }
+    if (stage->input.text != NULL) {
+      if ((cmd->inFile = templateText(arena, &stage->input)) == NULL) return NULL;
+      cmd->input = FILE_IN;
+    }
+    if (stage->output.text != NULL) {
+      if ((cmd->outFile = templateText(arena, &stage->output)) == NULL) return NULL;
+      cmd->output = stage->append ? FILE_APPEND : FILE_OUT;
+    }
+    addStage(arena, stmt, cmd);
+  }
+  return stmt;
+}
+
+/***
+ * processLine:
+ *    line: the len characters to process (need not be null-terminated;
+ *          REFERENCE is BORROWED)
+ *
+ *    The line is parsed once (see lineCache) and each statement (a|b|c)
+ *    is then built completely before it is executed so all of its stages
+ *    can be started together.  Statements run one after another, except
+ *    that one ended by & is only started (as a background job).
+ ***/
+void processLine(const char* line, size_t len) {
+  // Everything for a statement comes from this arena (reset after each one)
+  static Arena* arena = NULL;
+  if (arena == NULL && (arena = createArena(ARENA_BLOCK_SIZE)) == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.\n");
+    return;
+  }
+
+  reapJobs();   // Collect any background job that has finished
+
+  CompiledLine* compiled = getCompiledLine(line, len);
+  if (compiled == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.\n");
+    return;
+  }
+
+  int i;
+  for (i = 0; i < compiled->count; i++) {
+    StatementTemplate* tmpl = &compiled->statements[i];
+    Statement* stmt = buildStatement(arena, tmpl);
+    if (stmt != NULL) {
+      if (tmpl->background) startJob(stmt);
+      else executeStatement(stmt);
+    }
+
+    // Done with this statement - release it all at once
+    resetArena(arena);
+  }
+
+  if (compiled->error != NULL) {
+    fprintf(stderr, "%s", compiled->error);
+  }
+}
+
+// Where reading a mapped script that has been cut short (SIGBUS) returns to
+static sigjmp_buf scriptGone;
+
+static void scriptTruncated(int sig) {
+  siglongjmp(scriptGone, 1);
+}
+
+/***
+ * runMappedScript:
+ *    Run a script that is a regular file by mapping it into memory.
+ *    The mapping is read-only: each line is handed to processLine as a
+ *    span of the mapping (nothing is written, so no page is copied).
+ *    A line already in the line cache is never copied; a new one is
+ *    copied once, to be tokenized.
+ *    The file can still be changed by others (even by the script itself):
+ *    if it is truncated, touching a page past its new end raises SIGBUS,
+ *    which ends the script with an error instead of killing the shell.
+ *    (The line is only read before processLine copies what it keeps.)
+ *    Returns 0 if the file could not be mapped.
+ ***/
+int runMappedScript(int fd) {
+  struct stat info;
+  if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) return 0;
+
+  size_t size = info.st_size;
+  if (size == 0) return 1;   // Nothing to do
+
+  char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED) return 0;
+  madvise(text, size, MADV_SEQUENTIAL);
+
+  struct sigaction onBus, old;
+  memset(&onBus, 0, sizeof(onBus));
+  onBus.sa_handler = scriptTruncated;
+  sigemptyset(&onBus.sa_mask);
+  sigaction(SIGBUS, &onBus, &old);
+  if (sigsetjmp(scriptGone, 1) != 0) {
+    fprintf(stderr, ">> Error: script was truncated while running\n");
+    sigaction(SIGBUS, &old, NULL);
+    munmap(text, size);
+    return 1;
+  }
+
+  char* curr = text;
+  char* end = text + size;
+  while (curr < end) {
+    char* newline = memchr(curr, '\n', end - curr);
+    if (newline == NULL) newline = end;   // Last line has no newline
+    processLine(curr, newline - curr);
+    curr = newline + 1;
+  }
+
+  sigaction(SIGBUS, &old, NULL);
+  munmap(text, size);
+  return 1;
+}
+
+/***
+ * runStreamedScript:
+ *    Run a script that cannot be mapped (a pipe, ...) by reading it in
+ *    large chunks.  Complete lines are processed straight out of the
+ *    buffer; the buffer only grows if a single line does not fit.
+ ***/
+void runStreamedScript(int fd) {
+  size_t size = SCRIPT_CHUNK_SIZE;
+  size_t len = 0;      // Bytes in buffer
+  char* buffer = malloc(size);
+  if (buffer == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.\n");
+    return;
+  }
+
+  while (1) {
+    if (len == size) {
+      // One line fills the whole buffer - make room for more of it
+      char* bigger = realloc(buffer, size * 2);
+      if (bigger == NULL) {
+	fprintf(stderr, ">> Error: Out of memory.\n");
+	break;
       }
-      processMode = CMD;  // Switch back to processing mode
+      buffer = bigger;
+      size *= 2;
+    }
+
+    ssize_t got = read(fd, buffer + len, size - len);
+    if (got == -1 && errno == EINTR) continue;
+    if (got <= 0) {
+      // End of script - process any last line without a newline
+      if (len > 0) processLine(buffer, len);
       break;
+    }
 
-    default:
-      fprintf(stderr, "Programming Error: Unrecognized type returned!!!\n");
-      if (cmd != NULL ) {
-	freeCommand(cmd);
-	cmd = NULL;
-      }
-      return;
+    // Process every complete line now in the buffer
+    size_t scanned = len;
+    len += got;
+    char* curr = buffer;
+    char* newline;
+    while ((newline = memchr(buffer + scanned, '\n', len - scanned)) != NULL) {
+      processLine(curr, newline - curr);
+      curr = newline + 1;
+      scanned = curr - buffer;
     }
-    answer = getNextToken();
+
+    // Keep the partial line for the next read
+    len -= curr - buffer;
+    memmove(buffer, curr, len);
   }
 
-  // Should only happen once doneFlag is set and SEMICOLON process is executed
-  assert(cmd == NULL);
+  free(buffer);
+}
+
+/***
+ * runScript:
+ *    Run every line of the named script file (non-interactive: no prompt)
+ *    Returns 0 if the script could not be opened.
+ ***/
+int runScript(const char* name) {
+  int fd = open(name, O_RDONLY | O_CLOEXEC);   // Not passed on to every command
+  if (fd == -1) {
+    fprintf(stderr, ">> Error: %s: %s\n", name, strerror(errno));
+    return 0;
+  }
+
+  if (!runMappedScript(fd)) {
+    runStreamedScript(fd);
+  }
+  close(fd);
+  return 1;
+}
+
+/***
+ * waitForInput:
+ *    Wait until stdin has a line to read, reaping background jobs as
+ *    they finish meanwhile (jobFd: from watchJobs).  When one is
+ *    reported, the prompt is shown again after it.
+ ***/
+static void waitForInput(int jobFd) {
+  struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { jobFd, POLLIN, 0 } };
+  fflush(stdout);   // The prompt (getline would flush it, but we wait first)
+  while (1) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      return;   // Leave it to getline
+    }
+    if (fds[1].revents & POLLIN) {
+      if (reapJobs() > 0 && currStatus) {
+	shellPrompt();
+	fflush(stdout);
+      }
+    }
+    if (fds[0].revents != 0) return;   // Input (or EOF/hangup - getline sees it)
+  }
 }
 
 int main(int argc, char* argv[]) {
   varList = createVarSet();
 
-  char line[MAX_LINE_LENGTH+1];
+  if (argc > 1) {
+    // Non-interactive: run the script given (any other arguments are ignored)
+    return runScript(argv[1]) ? 0 : 1;
+  }
+
+  char* line = NULL;
+  size_t lineSize = 0;
+
+  // At a terminal, report background jobs as they finish - not only at
+  // the next line.  (Each read of a terminal gets one line, so nothing
+  // is left in stdin's buffer for poll to miss.)
+  int jobFd = isatty(STDIN_FILENO) ? watchJobs() : -1;
 
   shellPrompt();
+  if (jobFd != -1) waitForInput(jobFd);
 
-  while (fgets(line, MAX_LINE_LENGTH+1, stdin) != NULL) {
-    // We have our current line
-    processLine(line);
+  ssize_t got;
+  while ((got = getline(&line, &lineSize, stdin)) != -1) {
+    // We have our current line (of any length)
+    if (got > 0 && line[got - 1] == '\n') got--;   // (Keyed the same as in a script)
+    processLine(line, got);
     shellPrompt();
+    if (jobFd != -1) waitForInput(jobFd);
   }
 
+  free(line);
+
   // Everything ran smoothly
   return 0;
 }
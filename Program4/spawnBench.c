@@ -0,0 +1,69 @@
+/*******
+ * Spawn-rate benchmark
+ *    Launches /bin/true repeatedly (and waits for it) using
+ *    fork+exec and then posix_spawn, and reports launches per second.
+ *    A heap "ballast" is allocated and touched first to mimic a shell
+ *    with a large variable set: fork has to copy its page tables,
+ *    posix_spawn does not.
+ *
+ *    Usage: spawnBench [count] [ballastMB]   (defaults: 10000 64)
+ *******/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* trueArgv[] = { "/bin/true", NULL };
+
+static void launchFork() {
+  pid_t pid = fork();
+  if (pid == 0) {
+    execv(trueArgv[0], trueArgv);
+    _exit(2);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+static void launchSpawn() {
+  pid_t pid;
+  if (posix_spawn(&pid, trueArgv[0], NULL, NULL, trueArgv, environ) == 0) {
+    waitpid(pid, NULL, 0);
+  }
+}
+
+static void runBench(const char* name, void (*launch)(), long count) {
+  long i;
+  double start = now();
+  for (i = 0; i < count; i++) launch();
+  double elapsed = now() - start;
+  printf("%-12s %ld launches in %6.2f s  (%8.0f launches/s)\n",
+	 name, count, elapsed, count / elapsed);
+}
+
+int main(int argc, char* argv[]) {
+  long count = (argc > 1) ? atol(argv[1]) : 10000;
+  long ballastMB = (argc > 2) ? atol(argv[2]) : 64;
+
+  // Touch every page so they are really mapped
+  char* ballast = malloc(ballastMB << 20);
+  if (ballast != NULL) memset(ballast, 1, ballastMB << 20);
+  printf("Parent heap ballast: %ld MB\n", ballastMB);
+
+  runBench("fork+exec", launchFork, count);
+  runBench("posix_spawn", launchSpawn, count);
+
+  free(ballast);
+  return 0;
+}
@@ -0,0 +1,844 @@
+/*******
+ * Statement
+ *    See statement.h for details.
+ *******/
+
+#define _GNU_SOURCE   // For RUSAGE_THREAD and pipe2
+#include "statement.h"
+#include "command.h"
+#include "builtins.h"
+#include "pathCache.h"
+#include "global.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <pthread.h>
+
+extern char** environ;
+
+/***
+ * What one stage cost (filled in as it is reaped)
+ ***/
+typedef struct {
+  char* command;           // Its command name (BORROWED)
+  struct timespec start;   // When it was launched
+  struct timespec end;     // When it was reaped
+  struct rusage usage;     // From wait4 (or getrusage for a builtin run in the shell)
+  int status;              // Its exit status
+  int done;                // 1 once reaped (0 if it could not be started)
+  int inShell;             // 1 if it ran in the shell (its maxrss is the shell's peak, not its own)
+} StageUsage;
+
+/***
+ * A builtin stage of a pipeline, run on a helper thread of the shell.
+ * The thread owns its pipe ends and closes them when it finishes - just
+ * as a child's ends close when it exits.
+ ***/
+typedef struct {
+  Command* cmd;            // BORROWED
+  int in;                  // Read end of its input pipe (-1 if none)
+  int out;                 // Write end of its output pipe (-1 for the shell's stdout)
+  StageUsage* usage;       // Where its cost goes (BORROWED)
+} BuiltinStage;
+
+/***
+ * A background statement (ended by &): its children are reaped whenever
+ * the shell next waits, in whatever order they finish.
+ ***/
+typedef struct job {
+  int number;              // Job number (as reported)
+  int count;               // Number of stages
+  pid_t* pids;             // Child of each stage (REFERENCE is OWNED)
+  int* launched;           // Whether stage i has a child to reap (REFERENCE is OWNED)
+  StageUsage* stages;      // What each stage cost (REFERENCE is OWNED - as are their command copies)
+  int remaining;           // Children not yet reaped
+  int lastStatus;          // Exit status of the job (its last stage)
+  struct timespec start;
+  struct job* next;        // REFERENCE is OWNED
+} Job;
+
+static Job* jobs = NULL;   // Running jobs, newest first
+static int running = 0;    // Number of them
+
+// Self-pipe: SIGCHLD writes a byte to it so a shell idle at its prompt
+// wakes up to reap and report jobs as they finish (-1s until watchJobs)
+static int childPipe[2] = { -1, -1 };
+
+/***
+ * newStatement:
+ *    Create a new empty statement (allocated from arena)
+ *    REFERENCE returned is GIVEN (until the arena is reset)
+ *    Returns NULL if out of memory.
+ ***/
+Statement* newStatement(Arena* arena) {
+  Statement* ans = arenaAlloc(arena, sizeof(Statement));
+  if (ans == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.\n");
+    return NULL;
+  }
+  ans->stages = NULL;
+  ans->count = 0;
+  ans->capacity = 0;
+  return ans;
+}
+
+/***
+ * addStage:
+ *    Append a command to the end of the statement's pipeline
+ *    (growing the stage array in the arena when it is full)
+ *    REFERENCEs are BORROWED
+ ***/
+void addStage(Arena* arena, Statement* stmt, Command* cmd) {
+  if (stmt->count == stmt->capacity) {
+    int newCapacity = stmt->capacity == 0 ? 4 : stmt->capacity * 2;
+    Command** bigger = arenaAlloc(arena, newCapacity * sizeof(Command*));
+    if (bigger == NULL) {
+      fprintf(stderr, ">> Error: Out of memory.  Command not added.\n");
+      return;
+    }
+    if (stmt->count > 0) memcpy(bigger, stmt->stages, stmt->count * sizeof(Command*));
+    stmt->stages = bigger;
+    stmt->capacity = newCapacity;
+  }
+  stmt->stages[stmt->count++] = cmd;
+}
+
+/***
+ * exitStatus:
+ *    Convert a wait status into a shell exit status
+ ***/
+static int exitStatus(int status) {
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return 1;
+}
+
+/***
+ * seconds:
+ *    Time from start to end (or of a timeval) in seconds
+ ***/
+static double seconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double cpuSeconds(struct timeval* tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/***
+ * printUsage:
+ *    Print (to stderr) the exit status of the statement - the status of
+ *    its last stage - and then what each stage cost: wall time, user and
+ *    system CPU time, maximum resident set size and context switches
+ *    (voluntary/involuntary).  A pipeline also gets a total line: the
+ *    statement's wall time, the largest maxrss of any stage and the sum
+ *    of the rest over every stage.  A builtin run in the shell has no
+ *    maxrss of its own (getrusage only gives the shell's lifetime peak),
+ *    so "-" is printed for it.
+ *    job: the job number of a background statement (0 if it is not one)
+ *    REFERENCEs are BORROWED
+ ***/
+static void printUsage(int job, StageUsage* stages, int n, int lastStatus, struct timespec* start) {
+  int i;
+  double user = 0, sys = 0;
+  long rss = -1, voluntary = 0, involuntary = 0;   // (rss: -1 until a stage has its own)
+  struct timespec end = *start;
+
+  if (job > 0) fprintf(stderr, ">> [%d] Done: Exit %d\n", job, lastStatus);
+  else fprintf(stderr, ">> Done: Exit %d\n", lastStatus);
+  for (i = 0; i < n; i++) {
+    StageUsage* stage = &stages[i];
+    if (!stage->done) {
+      fprintf(stderr, ">>    %d %s: not started\n", i + 1, stage->command);
+      continue;
+    }
+    struct rusage* ru = &stage->usage;
+    char maxrss[32] = "-";
+    if (!stage->inShell) {
+      snprintf(maxrss, sizeof(maxrss), "%ldKB", ru->ru_maxrss);
+      if (ru->ru_maxrss > rss) rss = ru->ru_maxrss;
+    }
+    fprintf(stderr, ">>    %d %s: exit %d  wall %.3fs  user %.3fs  sys %.3fs  maxrss %s  ctxsw %ld/%ld\n",
+	    i + 1, stage->command, stage->status, seconds(&stage->start, &stage->end),
+	    cpuSeconds(&ru->ru_utime), cpuSeconds(&ru->ru_stime), maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+    user += cpuSeconds(&ru->ru_utime);
+    sys += cpuSeconds(&ru->ru_stime);
+    voluntary += ru->ru_nvcsw;
+    involuntary += ru->ru_nivcsw;
+    if (seconds(&end, &stage->end) > 0) end = stage->end;
+  }
+  if (n > 1) {
+    char maxrss[32] = "-";
+    if (rss != -1) snprintf(maxrss, sizeof(maxrss), "%ldKB", rss);
+    fprintf(stderr, ">>    total: wall %.3fs  user %.3fs  sys %.3fs  maxrss %s  ctxsw %ld/%ld\n",
+	    seconds(start, &end), user, sys, maxrss, voluntary, involuntary);
+  }
+}
+
+/***
+ * openRedirects:
+ *    Open the files a command is redirected from/to: files[0] gets its
+ *    input file, files[1] its output file (-1 if none).  They are opened
+ *    close-on-exec, so only the stage they are handed to keeps them.
+ *    Returns 0 on success; otherwise the error is reported, nothing is
+ *    left open and -1 is returned.
+ ***/
+static int openRedirects(Command* cmd, int files[2]) {
+  files[0] = files[1] = -1;
+  if (cmd->input == FILE_IN && (files[0] = open(cmd->inFile, O_RDONLY | O_CLOEXEC)) == -1) {
+    fprintf(stderr, ">> Error: %s: %s\n", cmd->inFile, strerror(errno));
+    return -1;
+  }
+  if (cmd->output == FILE_OUT || cmd->output == FILE_APPEND) {
+    int mode = (cmd->output == FILE_APPEND) ? O_APPEND : O_TRUNC;
+    if ((files[1] = open(cmd->outFile, O_WRONLY | O_CREAT | O_CLOEXEC | mode, 0644)) == -1) {
+      fprintf(stderr, ">> Error: %s: %s\n", cmd->outFile, strerror(errno));
+      if (files[0] != -1) close(files[0]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/***
+ * runBuiltin:
+ *    Run a statement that is a single builtin in the shell itself
+ *    (so SET, CD, ... affect the shell).  Its cost is the change in
+ *    the shell's own resource usage while it ran.
+ *    Returns its exit status (always success - unless a redirection
+ *    could not be opened)
+ ***/
+static int runBuiltin(Statement* stmt) {
+  StageUsage stage;
+  struct rusage before;
+  Command* cmd = stmt->stages[0];
+  int files[2];
+  FILE* out = stdout;
+
+  if (openRedirects(cmd, files) == -1) return 1;
+  if (files[1] != -1 && (out = fdopen(files[1], "w")) == NULL) {
+    fprintf(stderr, ">> Error: %s\n", strerror(errno));
+    close(files[1]);
+    if (files[0] != -1) close(files[0]);
+    return 1;
+  }
+
+  stage.command = cmd->command;
+  stage.inShell = 1;
+  clock_gettime(CLOCK_MONOTONIC, &stage.start);
+  getrusage(RUSAGE_SELF, &before);
+
+  processBuiltin(cmd, files[0] != -1 ? files[0] : STDIN_FILENO, out, 0);
+  if (out != stdout) fclose(out);
+  if (files[0] != -1) close(files[0]);
+
+  if (currStatus) {
+    // (STATUS itself may just have turned reporting on)
+    clock_gettime(CLOCK_MONOTONIC, &stage.end);
+    getrusage(RUSAGE_SELF, &stage.usage);
+    timersub(&stage.usage.ru_utime, &before.ru_utime, &stage.usage.ru_utime);
+    timersub(&stage.usage.ru_stime, &before.ru_stime, &stage.usage.ru_stime);
+    stage.usage.ru_nvcsw -= before.ru_nvcsw;
+    stage.usage.ru_nivcsw -= before.ru_nivcsw;
+    stage.status = 0;
+    stage.done = 1;
+    printUsage(0, &stage, 1, 0, &stage.start);
+  }
+  return 0;   // Exit status of a builtin is always success
+}
+
+/***
+ * createPipes:
+ *    Create count pipes.  If $PIPESIZE is set, each one's capacity is
+ *    set to that many bytes (F_SETPIPE_SZ - the kernel rounds it up to
+ *    a power-of-2 number of pages) instead of the default 64KB, so a
+ *    fast writer does not have to stop every 64KB for its reader.
+ *    Returns 0 on success; on failure the error is reported, any pipes
+ *    already made are closed and -1 is returned.
+ ***/
+static int createPipes(int pipes[][2], int count) {
+  VarEntry* var = findInSet(varList, "PIPESIZE");
+  long size = (var != NULL) ? atol(var->value) : 0;
+  int i, j;
+
+  for (i = 0; i < count; i++) {
+    if (pipe(pipes[i]) == -1) {
+      fprintf(stderr, ">> Error: %s\n", strerror(errno));
+      for (j = 0; j < i; j++) { close(pipes[j][0]); close(pipes[j][1]); }
+      return -1;
+    }
+    if (size > 0 && fcntl(pipes[i][0], F_SETPIPE_SZ, (int) size) == -1) {
+      // (Above /proc/sys/fs/pipe-max-size needs privilege) - keep the default
+      if (i == 0) fprintf(stderr, ">> Error: PIPESIZE %ld: %s\n", size, strerror(errno));
+    }
+  }
+  return 0;
+}
+
+/***
+ * hookUp:
+ *    Work out where every stage reads and writes: its redirected file,
+ *    else its pipe, else (-1) the shell's own stdin/stdout.
+ *    ends[i] gets stage i's (stdin, stdout) and files[i] the files opened
+ *    for it; ok[i] is 0 if one could not be opened (it must not start).
+ ***/
+static void hookUp(Statement* stmt, int pipes[][2], int files[][2], int ends[][2], int ok[]) {
+  int n = stmt->count;
+  int i;
+  for (i = 0; i < n; i++) {
+    Command* cmd = stmt->stages[i];
+    ok[i] = (openRedirects(cmd, files[i]) == 0);
+    ends[i][0] = (files[i][0] != -1) ? files[i][0] : (cmd->input == PIPE_IN && i > 0) ? pipes[i-1][0] : -1;
+    ends[i][1] = (files[i][1] != -1) ? files[i][1] : (cmd->output == PIPE_OUT && i < n-1) ? pipes[i][1] : -1;
+  }
+}
+
+/***
+ * closeUnused:
+ *    Parent: close its copy of every pipe end and redirected file once the
+ *    children have theirs (so readers see EOF when writers finish) -
+ *    except those of the stages in keep, whose threads close them.
+ ***/
+static void closeUnused(int n, int pipes[][2], int files[][2], int ends[][2], int keep[]) {
+  int i, j, k;
+  for (j = 0; j < n-1; j++) {
+    for (k = 0; k < 2; k++) {
+      int kept = 0;
+      for (i = 0; i < n; i++) {
+	if (keep[i] && (ends[i][0] == pipes[j][k] || ends[i][1] == pipes[j][k])) kept = 1;
+      }
+      if (!kept) close(pipes[j][k]);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < 2; k++) {
+      if (files[i][k] != -1 && !keep[i]) close(files[i][k]);
+    }
+  }
+}
+
+/***
+ * dropCatStages:
+ *    A stage that is just cat (no options, at most one file) only copies
+ *    its input to its output - a whole process and a copy of all the data
+ *    for nothing.  In a pipeline it is dropped, and its input is handed
+ *    straight to the next stage:  cat f | b  runs as  b < f,  a | cat | b
+ *    as  a | b.  As the last stage (reading a pipe) its output goes to the
+ *    stage before instead:  a | cat > f  runs as  a > f.
+ *    A cat is kept if what it reads cannot be opened (cat reports that and
+ *    its neighbours still run), or if dropping it would leave a lone
+ *    builtin - that would then run in the shell itself, not detached.
+ ***/
+static void dropCatStages(Statement* stmt) {
+  int i = 0, j;
+  while (stmt->count > 1 && i < stmt->count) {
+    Command* cat = stmt->stages[i];
+    Command* prev = (i > 0) ? stmt->stages[i-1] : NULL;
+    Command* next = (i < stmt->count-1) ? stmt->stages[i+1] : NULL;
+    if (strcmp(cat->command, "cat") != 0 || cat->argc > 2 ||
+	(cat->argc == 2 && (cat->argv[1][0] == '-' || cat->input == FILE_IN))) {
+      i++;
+      continue;
+    }
+
+    // What cat reads
+    int input = cat->input;
+    char* inFile = cat->inFile;
+    if (cat->argc == 2) {
+      input = FILE_IN;
+      inFile = cat->argv[1];
+    }
+
+    Command* other = (next != NULL) ? next : prev;
+    if ((input == FILE_IN && access(inFile, R_OK) == -1) ||
+	(stmt->count == 2 && isBuiltin(other))) {
+      i++;
+      continue;
+    }
+
+    if (next != NULL && cat->output == PIPE_OUT && next->input == PIPE_IN) {
+      next->input = input;
+      next->inFile = inFile;
+    } else if (next == NULL && prev != NULL && input == PIPE_IN && prev->output == PIPE_OUT) {
+      prev->output = cat->output;
+      prev->outFile = cat->outFile;
+    } else {
+      i++;
+      continue;
+    }
+    for (j = i; j < stmt->count-1; j++) stmt->stages[j] = stmt->stages[j+1];
+    stmt->count--;
+  }
+}
+
+/***
+ * spawnStage:
+ *    Launch stage i (an external command) with posix_spawn.
+ *    Its stdin/stdout (ends - a pipe or a redirected file) are hooked up
+ *    by file actions in the child, so the shell's page tables never need
+ *    to be copied (unlike fork).
+ *    The program is found through the command cache; if a cached path
+ *    no longer exists it is forgotten and PATH is searched once more.
+ *    Returns 0 and sets *pid on success, otherwise the error number.
+ ***/
+static int spawnStage(Statement* stmt, int i, int ends[2], int pipes[][2], pid_t* pid) {
+  int n = stmt->count;
+  int j, err;
+  posix_spawn_file_actions_t actions;
+  char** argv = stmt->stages[i]->argv;
+
+  posix_spawn_file_actions_init(&actions);
+  if (ends[0] != -1) posix_spawn_file_actions_adddup2(&actions, ends[0], STDIN_FILENO);
+  if (ends[1] != -1) posix_spawn_file_actions_adddup2(&actions, ends[1], STDOUT_FILENO);
+  for (j = 0; j < n-1; j++) {
+    posix_spawn_file_actions_addclose(&actions, pipes[j][0]);
+    posix_spawn_file_actions_addclose(&actions, pipes[j][1]);
+  }
+
+  char* path = findCommand(argv[0]);
+  err = (path == NULL) ? ENOENT : posix_spawn(pid, path, &actions, NULL, argv, environ);
+  if (err == ENOENT && path != NULL && path != argv[0]) {
+    // Stale cache entry - search again
+    forgetCommand(argv[0]);
+    path = findCommand(argv[0]);
+    if (path != NULL) err = posix_spawn(pid, path, &actions, NULL, argv, environ);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  return err;
+}
+
+/***
+ * forkStage:
+ *    Launch stage i in a forked child (a builtin in a background job
+ *    runs there, so it cannot race the shell).  Returns 0 and sets *pid
+ *    on success, otherwise the error number.
+ ***/
+static int forkStage(Statement* stmt, int i, int ends[2], int pipes[][2], pid_t* pid) {
+  int n = stmt->count;
+  int j;
+
+  *pid = fork();
+  if (*pid == -1) return errno;
+
+  if (*pid == 0) {
+    // Child: hook up to its neighbours and drop every other pipe end
+    if (ends[0] != -1) dup2(ends[0], STDIN_FILENO);
+    if (ends[1] != -1) dup2(ends[1], STDOUT_FILENO);
+    for (j = 0; j < n-1; j++) { close(pipes[j][0]); close(pipes[j][1]); }
+    executeCommand(stmt->stages[i]);   // Does not return
+  }
+  return 0;
+}
+
+/***
+ * runBuiltinStage:
+ *    Body of the helper thread for a builtin in a pipeline: run it
+ *    (detached, so it cannot change the shell) writing into its output
+ *    pipe, then close its pipe ends and record what its thread cost.
+ *    Only PASS reads its input - for the rest it is just closed at the end.
+ *    arg: a BORROWED BuiltinStage
+ ***/
+static void* runBuiltinStage(void* arg) {
+  BuiltinStage* stage = arg;
+  FILE* out = stdout;
+
+  if (stage->out != -1 && (out = fdopen(stage->out, "w")) == NULL) {
+    fprintf(stderr, ">> Error: %s\n", strerror(errno));
+    close(stage->out);
+  }
+  if (out != NULL) {
+    processBuiltin(stage->cmd, stage->in != -1 ? stage->in : STDIN_FILENO, out, 1);
+    // A reader that quit early just means EPIPE (SIGPIPE is blocked here)
+    if (out == stdout) fflush(stdout);
+    else fclose(out);
+  }
+  if (stage->in != -1) close(stage->in);
+
+  clock_gettime(CLOCK_MONOTONIC, &stage->usage->end);
+  getrusage(RUSAGE_THREAD, &stage->usage->usage);
+  stage->usage->status = 0;   // Exit status of a builtin is always success
+  stage->usage->done = 1;
+  return NULL;
+}
+
+/***
+ * startBuiltinStage:
+ *    Start stage i (a builtin) on a helper thread that owns the pipe
+ *    ends given in stage.  SIGPIPE stays blocked on that thread, so a
+ *    reader that has gone away cannot kill the shell (a blocked SIGPIPE
+ *    aimed at a thread is dropped when the thread exits).
+ *    Returns 0 and sets *thread on success, otherwise the error number.
+ ***/
+static int startBuiltinStage(BuiltinStage* stage, pthread_t* thread) {
+  sigset_t pipeSignal, old;
+  int err;
+
+  sigemptyset(&pipeSignal);
+  sigaddset(&pipeSignal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipeSignal, &old);   // Inherited by the new thread
+  err = pthread_create(thread, NULL, runBuiltinStage, stage);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return err;
+}
+
+static void jobChildExited(pid_t pid, int status, struct rusage* usage);
+
+/***
+ * executeStatement:
+ *    Run every stage of the statement concurrently.
+ *    Plain cat stages are dropped first (see dropCatStages).
+ *    A statement that is a single builtin is run in the shell itself
+ *    (so SET, CD, ... affect the shell).  Otherwise all pipes are created,
+ *    one child is started per external command by posix_spawn, the parent
+ *    closes its copies of their pipe ends, and only then is each builtin
+ *    started on a helper thread writing straight into its pipe - no
+ *    process per builtin.  The shell then waits for every child (with
+ *    wait4, to get what each one cost) and joins every thread.
+ *    With STATUS on, the exit status and costs are then reported.
+ *    Returns the exit status of the last stage.
+ *    REFERENCEs are BORROWED
+ ***/
+int executeStatement(Statement* stmt) {
+  assert(stmt != NULL);
+  dropCatStages(stmt);
+  int n = stmt->count;
+  if (n == 0) return 0;  // Empty statement
+
+  if (n == 1 && isBuiltin(stmt->stages[0])) {
+    return runBuiltin(stmt);
+  }
+
+  int pipes[n > 1 ? n-1 : 1][2];   // (Never zero-length: a lone stage has no pipes)
+  int files[n][2], ends[n][2], ok[n];
+  pid_t pids[n];
+  StageUsage stages[n];
+  struct timespec start;
+  int i;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Create every pipe up front (and open every redirected file)
+  if (createPipes(pipes, n-1) == -1) return 1;
+  hookUp(stmt, pipes, files, ends, ok);
+
+  // Anything still buffered would otherwise be written by every child too
+  fflush(NULL);
+
+  // And a child for every external command
+  int launched[n];   // Whether stage i has a child to wait for
+  int builtin[n];    // Whether stage i is a builtin to run on a thread
+  for (i = 0; i < n; i++) {
+    int err;
+    stages[i].command = stmt->stages[i]->command;
+    stages[i].done = 0;
+    launched[i] = 0;
+    builtin[i] = isBuiltin(stmt->stages[i]) && ok[i];
+    stages[i].inShell = builtin[i];   // (On a thread of the shell)
+    if (builtin[i] || !ok[i]) continue;
+    clock_gettime(CLOCK_MONOTONIC, &stages[i].start);
+    err = spawnStage(stmt, i, ends[i], pipes, &pids[i]);
+    launched[i] = (err == 0);
+    if (err != 0) {
+      fprintf(stderr, ">> Error: %s\n", strerror(err));
+    }
+  }
+
+  // Parent: close its pipe ends and files so readers see EOF when writers
+  // finish (except those a builtin's thread will use - it closes them itself)
+  closeUnused(n, pipes, files, ends, builtin);
+
+  // Only now start the builtins: every child has its copies of the pipes
+  BuiltinStage builtins[n];
+  pthread_t threads[n];
+  int started[n];    // Whether stage i has a thread to join
+  for (i = 0; i < n; i++) {
+    started[i] = 0;
+    if (!builtin[i]) continue;
+    builtins[i].cmd = stmt->stages[i];
+    builtins[i].in = ends[i][0];
+    builtins[i].out = ends[i][1];
+    builtins[i].usage = &stages[i];
+    clock_gettime(CLOCK_MONOTONIC, &stages[i].start);
+    int err = startBuiltinStage(&builtins[i], &threads[i]);
+    started[i] = (err == 0);
+    if (err != 0) {
+      fprintf(stderr, ">> Error: %s\n", strerror(err));
+      if (builtins[i].in != -1) close(builtins[i].in);
+      if (builtins[i].out != -1) close(builtins[i].out);
+    }
+  }
+
+  // Reap every stage - in whatever order they finish
+  // A stage that could not be started counts as exit status 2
+  int remaining = 0;
+  for (i = 0; i < n; i++) remaining += launched[i];
+  int lastStatus = (launched[n-1] || started[n-1]) ? 0 : 2;
+  while (remaining > 0) {
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, 0, &usage);
+    if (pid == -1) {
+      if (errno == EINTR) continue;
+      break;   // No more children
+    }
+    for (i = 0; i < n; i++) {
+      if (launched[i] && pids[i] == pid) {
+	remaining--;
+	clock_gettime(CLOCK_MONOTONIC, &stages[i].end);
+	stages[i].usage = usage;
+	stages[i].status = exitStatus(status);
+	stages[i].done = 1;
+	if (i == n-1) lastStatus = stages[i].status;
+	break;
+      }
+    }
+    if (i == n) jobChildExited(pid, status, &usage);   // One of a background job's
+  }
+
+  for (i = 0; i < n; i++) {
+    if (started[i]) pthread_join(threads[i], NULL);
+  }
+
+  if (currStatus) printUsage(0, stages, n, lastStatus, &start);
+  return lastStatus;
+}
+
+/***
+ * freeJob:
+ *    Release a job (and its copies of the command names)
+ ***/
+static void freeJob(Job* job) {
+  int i;
+  for (i = 0; i < job->count; i++) free(job->stages[i].command);
+  free(job->stages);
+  free(job->launched);
+  free(job->pids);
+  free(job);
+}
+
+/***
+ * jobChildExited:
+ *    Record that child pid (of some background job) exited with the
+ *    given wait status.  Once a job's last child is reaped it is
+ *    reported (with STATUS on) and dropped.
+ ***/
+static void jobChildExited(pid_t pid, int status, struct rusage* usage) {
+  Job** link;
+  int i;
+  for (link = &jobs; *link != NULL; link = &(*link)->next) {
+    Job* job = *link;
+    for (i = 0; i < job->count; i++) {
+      if (job->launched[i] && job->pids[i] == pid) break;
+    }
+    if (i == job->count) continue;
+
+    job->launched[i] = 0;
+    job->remaining--;
+    clock_gettime(CLOCK_MONOTONIC, &job->stages[i].end);
+    job->stages[i].usage = *usage;
+    job->stages[i].status = exitStatus(status);
+    job->stages[i].done = 1;
+    if (i == job->count - 1) job->lastStatus = job->stages[i].status;
+
+    if (job->remaining == 0) {
+      if (currStatus) printUsage(job->number, job->stages, job->count, job->lastStatus, &job->start);
+      *link = job->next;
+      running--;
+      freeJob(job);
+    }
+    return;
+  }
+  // Not ours (already reaped elsewhere) - nothing to do
+}
+
+/***
+ * reapJob:
+ *    Reap one child of a background job.
+ *    block: 1 to wait for one to finish, 0 to only take one that already has
+ *    Returns 1 if a child was reaped, 0 if none was (or none is left).
+ ***/
+static int reapJob(int block) {
+  while (running > 0) {
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, block ? 0 : WNOHANG, &usage);
+    if (pid == -1 && errno == EINTR) continue;
+    if (pid <= 0) return 0;
+    jobChildExited(pid, status, &usage);
+    return 1;
+  }
+  return 0;
+}
+
+/***
+ * maxJobs:
+ *    How many background jobs may run at once: $MAXJOBS if it is set
+ *    to a positive number, otherwise the number of online CPUs.
+ ***/
+static int maxJobs() {
+  VarEntry* var = findInSet(varList, "MAXJOBS");
+  int limit = (var != NULL) ? atoi(var->value) : 0;
+  if (limit < 1) limit = sysconf(_SC_NPROCESSORS_ONLN);
+  return limit < 1 ? 1 : limit;
+}
+
+/***
+ * childExited:
+ *    SIGCHLD handler - only pokes the self-pipe (the reaping itself is
+ *    not safe in a handler: it prints and frees).
+ ***/
+static void childExited(int sig) {
+  int saved = errno;
+  if (childPipe[1] != -1) write(childPipe[1], "", 1);   // Full is fine - already poked
+  errno = saved;
+}
+
+/***
+ * watchJobs:
+ *    Have SIGCHLD poke a self-pipe whenever a child exits.
+ *    Returns the pipe's read end, readable once reapJobs has something
+ *    to do (-1 if it could not be set up - jobs are then only reaped
+ *    when the shell next waits, as in scripts).
+ ***/
+int watchJobs() {
+  if (childPipe[0] != -1) return childPipe[0];
+  if (pipe2(childPipe, O_CLOEXEC | O_NONBLOCK) == -1) return -1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = childExited;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &action, NULL) == -1) {
+    close(childPipe[0]);
+    close(childPipe[1]);
+    childPipe[0] = childPipe[1] = -1;
+    return -1;
+  }
+  return childPipe[0];
+}
+
+/***
+ * reapJobs:
+ *    Reap every child of a background job that has already finished
+ *    (never blocks) - called before each line, and whenever the self-pipe
+ *    is poked, so finished jobs do not linger as zombies.
+ *    Returns the number of jobs that finished.
+ ***/
+int reapJobs() {
+  char drain[64];
+  if (childPipe[0] != -1) {
+    while (read(childPipe[0], drain, sizeof(drain)) > 0) ;
+  }
+  int before = running;
+  while (reapJob(0)) ;
+  return before - running;
+}
+
+/***
+ * waitForJobs:
+ *    Wait until every background job has finished (WAIT)
+ ***/
+void waitForJobs() {
+  while (running > 0 && reapJob(1)) ;
+}
+
+/***
+ * startJob:
+ *    Start the statement as a background job and return without waiting
+ *    for it.  If MAXJOBS jobs are already running, first wait until one
+ *    of them finishes.  Every stage runs in a child - a builtin in a
+ *    forked one (like any background builtin, it cannot change the shell).
+ *    Its children are reaped by whichever wait comes next (a foreground
+ *    statement's, another job's, WAIT, or reapJobs).
+ *    REFERENCEs are BORROWED (the job keeps its own copy of what it needs)
+ ***/
+void startJob(Statement* stmt) {
+  assert(stmt != NULL);
+  dropCatStages(stmt);
+  int n = stmt->count;
+  if (n == 0) return;  // Empty statement
+
+  reapJobs();
+  int limit = maxJobs();
+  while (running >= limit && reapJob(1)) ;
+
+  Job* job = malloc(sizeof(Job));
+  if (job != NULL) {
+    job->pids = malloc(n * sizeof(pid_t));
+    job->launched = malloc(n * sizeof(int));
+    job->stages = malloc(n * sizeof(StageUsage));
+  }
+  if (job == NULL || job->pids == NULL || job->launched == NULL || job->stages == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.\n");
+    if (job != NULL) { free(job->pids); free(job->launched); free(job->stages); free(job); }
+    return;
+  }
+
+  int pipes[n > 1 ? n-1 : 1][2];   // (Never zero-length: a lone stage has no pipes)
+  int files[n][2], ends[n][2], ok[n], keep[n];
+  int i;
+  if (createPipes(pipes, n-1) == -1) {
+    free(job->pids); free(job->launched); free(job->stages); free(job);
+    return;
+  }
+  hookUp(stmt, pipes, files, ends, ok);
+
+  // Anything still buffered would otherwise be written by every child too
+  fflush(NULL);
+
+  job->count = n;
+  job->remaining = 0;
+  job->lastStatus = 2;   // Unless the last stage starts
+  job->number = (jobs == NULL) ? 1 : jobs->number + 1;
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  for (i = 0; i < n; i++) {
+    int err;
+    job->stages[i].command = strdup(stmt->stages[i]->command);
+    job->stages[i].done = 0;
+    job->stages[i].inShell = 0;   // (Even a builtin is forked)
+    clock_gettime(CLOCK_MONOTONIC, &job->stages[i].start);
+    keep[i] = 0;
+    job->launched[i] = 0;
+    if (!ok[i]) continue;
+    if (isBuiltin(stmt->stages[i])) {
+      err = forkStage(stmt, i, ends[i], pipes, &job->pids[i]);
+    } else {
+      err = spawnStage(stmt, i, ends[i], pipes, &job->pids[i]);
+    }
+    job->launched[i] = (err == 0);
+    job->remaining += job->launched[i];
+    if (err != 0) {
+      fprintf(stderr, ">> Error: %s\n", strerror(err));
+    }
+  }
+  if (job->launched[n-1]) job->lastStatus = 0;
+
+  // Parent: close its pipe ends and files so readers see EOF when writers finish
+  closeUnused(n, pipes, files, ends, keep);
+
+  if (job->remaining == 0) {
+    // Nothing started - it is already done
+    if (currStatus) printUsage(job->number, job->stages, n, job->lastStatus, &job->start);
+    freeJob(job);
+    return;
+  }
+  if (currStatus) {
+    for (i = n-1; !job->launched[i]; i--) ;
+    fprintf(stderr, ">> [%d] %d\n", job->number, (int) job->pids[i]);   // Like sh: its last process
+  }
+  job->next = jobs;
+  jobs = job;
+  running++;
+}
@@ -0,0 +1,42 @@
+/*******
+ * Statement
+ *    A sequence of (one or more) commands connected by pipes: a|b|c
+ *    The whole statement is built first and then executed at once:
+ *    every pipe and child process is created up front so all stages
+ *    stream concurrently, and the shell then reaps them in one wait loop.
+ *    Builtins in a pipeline run on helper threads of the shell, writing
+ *    straight into their pipes, so they cost no extra processes.
+ *    SET PIPESIZE bytes sets the capacity of every pipe it creates.
+ *
+ *    A statement ended by & is started as a background job instead: the
+ *    shell goes straight on, up to MAXJOBS jobs run at once, and their
+ *    children are reaped by whichever wait comes next (or WAIT).
+ *    Interactively, SIGCHLD pokes a self-pipe (see watchJobs) so jobs
+ *    are also reaped and reported as they finish.
+ *******/
+
+#ifndef __STATEMENT_H
+#define __STATEMENT_H
+
+#include "command.h"
+#include "arena.h"
+
+/***
+ * A Statement and its commands are allocated from an Arena
+ * (freed all at once when the arena is reset).
+ ***/
+typedef struct {
+  Command** stages;  // The commands in pipe order (in the arena)
+  int count;         // Number of stages
+  int capacity;      // Allocated size of stages
+} Statement;
+
+Statement* newStatement(Arena* arena);
+void addStage(Arena* arena, Statement* stmt, Command* cmd);
+int executeStatement(Statement* stmt);
+void startJob(Statement* stmt);
+int watchJobs();
+int reapJobs();
+void waitForJobs();
+
+#endif
@@ -0,0 +1,234 @@
+/*******
+ * Subst
+ *    See subst.h for details.
+ *******/
+
+#include "subst.h"
+#include "global.h"
+#include "varSet.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMO_SIZE 64   // Distinct variables remembered per statement (power of 2)
+
+// One level of substitution: a string held in the level buffer
+typedef struct {
+  size_t start;       // Offset in levelBuffer
+  size_t length;
+  unsigned int hash;
+} Level;
+
+// A remembered variable lookup (valid while gen == memoGen)
+typedef struct {
+  unsigned int gen;
+  unsigned int hash;
+  size_t length;
+  char* name;         // Copy of the name (in the arena)
+  char* value;        // The variable's value or "" (BORROWED)
+} MemoSlot;
+
+static char* levelBuffer = NULL;  // Every level of the current token, one after another
+static size_t levelBufferSize = 0;
+
+static MemoSlot memo[MEMO_SIZE];
+static unsigned int memoGen = 1;
+
+/***
+ * hashText:
+ *    FNV-1a hash of len characters of text
+ ***/
+static unsigned int hashText(const char* text, size_t len) {
+  unsigned int h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) text[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/***
+ * startSubstitution:
+ *    Start a new statement: forget the remembered lookups
+ *    (their names were in the arena and variables may have changed).
+ ***/
+void startSubstitution() {
+  memoGen++;
+}
+
+/***
+ * lookupVar:
+ *    Return the value of the variable called name (len characters,
+ *    not null-terminated) or "" if there is no such variable.
+ *    Returns NULL only if out of memory.
+ ***/
+static char* lookupVar(Arena* arena, const char* name, size_t len) {
+  unsigned int h = hashText(name, len);
+  size_t i, probes;
+  MemoSlot* slot = NULL;
+
+  for (i = h & (MEMO_SIZE - 1), probes = 0; probes < MEMO_SIZE; i = (i + 1) & (MEMO_SIZE - 1), probes++) {
+    if (memo[i].gen != memoGen) {
+      slot = &memo[i];   // Empty - remember the answer here
+      break;
+    }
+    if (memo[i].hash == h && memo[i].length == len && memcmp(memo[i].name, name, len) == 0) {
+      return memo[i].value;   // Already looked up
+    }
+  }
+
+  char* copy = arenaAlloc(arena, len + 1);
+  if (copy == NULL) return NULL;
+  memcpy(copy, name, len);
+  copy[len] = '\0';
+
+  VarEntry* var = findInSet(varList, copy);
+  char* value = (var != NULL) ? var->value : "";
+
+  if (slot != NULL) {
+    slot->gen = memoGen;
+    slot->hash = h;
+    slot->length = len;
+    slot->name = copy;
+    slot->value = value;
+  }
+  return value;
+}
+
+/***
+ * expandLevel:
+ *    Do one level of substitution of src (len characters).
+ *    src has no $ before scanFrom, so that part is just copied.
+ *    If out is NULL only the length is worked out.
+ *    Sets *outLen and *firstSub (where the first substituted value
+ *    starts in the output).  Returns the number of substitutions done
+ *    (-1 if out of memory).
+ ***/
+static int expandLevel(Arena* arena, const char* src, size_t len, size_t scanFrom,
+		       char* out, size_t* outLen, size_t* firstSub) {
+  size_t i = scanFrom, o = scanFrom;
+  int subs = 0;
+
+  if (out != NULL) memcpy(out, src, scanFrom);
+
+  while (i < len) {
+    const char* open = memchr(src + i, '$', len - i);
+    const char* close = (open != NULL) ? memchr(open + 1, '$', src + len - open - 1) : NULL;
+    if (close == NULL) break;   // No more $name$ pairs
+
+    // The literal text before the pair
+    size_t literal = open - (src + i);
+    if (out != NULL) memcpy(out + o, src + i, literal);
+    o += literal;
+
+    char* value = lookupVar(arena, open + 1, close - open - 1);
+    if (value == NULL) return -1;
+    size_t valueLen = strlen(value);
+    if (subs == 0) *firstSub = o;
+    if (out != NULL) memcpy(out + o, value, valueLen);
+    o += valueLen;
+
+    i = close + 1 - src;
+    subs++;
+  }
+
+  // The rest is literal
+  if (out != NULL) memcpy(out + o, src + i, len - i);
+  o += len - i;
+
+  *outLen = o;
+  return subs;
+}
+
+/***
+ * reserve:
+ *    Make sure levelBuffer can hold size bytes
+ ***/
+static int reserve(size_t size) {
+  if (size <= levelBufferSize) return 1;
+
+  size_t newSize = levelBufferSize == 0 ? 1024 : levelBufferSize;
+  while (newSize < size) newSize *= 2;
+  char* bigger = realloc(levelBuffer, newSize);
+  if (bigger == NULL) return 0;
+  levelBuffer = bigger;
+  levelBufferSize = newSize;
+  return 1;
+}
+
+/***
+ * expandLevels:
+ *    Run the substitution levels of token, filling in levels[].
+ *    Returns the index of the level that is the answer (-1 if out of memory).
+ ***/
+static int expandLevels(Arena* arena, char* token, size_t length, Level levels[]) {
+  size_t scanFrom = 0;
+  int k, j, final;
+
+  if (!reserve(length)) return -1;
+  memcpy(levelBuffer, token, length);
+  levels[0].start = 0;
+  levels[0].length = length;
+  levels[0].hash = hashText(token, length);
+
+  for (k = 0, final = 0; k < MAX_SUBSTITUTION_LEVEL; k++) {
+    Level* curr = &levels[k];
+    size_t outLen, firstSub = 0;
+
+    // First work out the size of the next level, then write it after this one
+    int subs = expandLevel(arena, levelBuffer + curr->start, curr->length, scanFrom,
+			   NULL, &outLen, &firstSub);
+    if (subs == -1) return -1;
+    if (subs == 0) break;   // Nothing changed - this level is the answer
+
+    size_t nextStart = curr->start + curr->length;
+    if (!reserve(nextStart + outLen)) return -1;
+    expandLevel(arena, levelBuffer + curr->start, curr->length, scanFrom,
+		levelBuffer + nextStart, &outLen, &firstSub);
+
+    Level* next = &levels[k+1];
+    next->start = nextStart;
+    next->length = outLen;
+    next->hash = hashText(levelBuffer + nextStart, outLen);
+    final = k + 1;
+
+    // Nothing before the first substituted value can start a new $name$
+    scanFrom = firstSub;
+
+    // Back to an earlier string?  Then it repeats with that period from here on
+    for (j = k; j >= 0; j--) {
+      if (levels[j].hash == next->hash && levels[j].length == next->length &&
+	  memcmp(levelBuffer + levels[j].start, levelBuffer + next->start, outLen) == 0) {
+	int period = k + 1 - j;
+	return j + (MAX_SUBSTITUTION_LEVEL - j) % period;
+      }
+    }
+  }
+  return final;
+}
+
+/***
+ * substitute:
+ *    Return token (length characters) with its variables substituted.
+ *    A token without any $ is returned as is (not copied), otherwise
+ *    the answer is allocated from arena.
+ *    Returns NULL if out of memory.
+ *    REFERENCEs are BORROWED
+ ***/
+char* substitute(Arena* arena, char* token, size_t length) {
+  if (memchr(token, '$', length) == NULL) return token;   // Nothing to do
+
+  Level levels[MAX_SUBSTITUTION_LEVEL + 1];
+  int final = expandLevels(arena, token, length, levels);
+  char* ans = (final == -1) ? NULL : arenaAlloc(arena, levels[final].length + 1);
+  if (ans == NULL) {
+    fprintf(stderr, ">> Error: Out of memory.  Variables not substituted.\n");
+    return NULL;
+  }
+
+  memcpy(ans, levelBuffer + levels[final].start, levels[final].length);
+  ans[levels[final].length] = '\0';
+  return ans;
+}
@@ -0,0 +1,27 @@
+/*******
+ * Subst
+ *    Variable substitution for tokens: each $name$ is replaced by the
+ *    value of the variable name (or "" if there is none).
+ *    If the result can be substituted again another level is done,
+ *    up to MAX_SUBSTITUTION_LEVEL levels.  A token stays a single token.
+ *
+ *    Every level is expanded into one growable buffer.  A level only
+ *    re-scans from the first place the previous level changed, stops as
+ *    soon as nothing changes, and recognises when it has come back to
+ *    an earlier string (a -> $a$, or a -> $b$ -> $a$) so the answer of
+ *    the last level can be picked without running the rest.
+ *    Variable lookups are remembered for the rest of the statement.
+ *******/
+
+#ifndef __SUBST_H
+#define __SUBST_H
+
+#include <stddef.h>
+#include "arena.h"
+
+#define MAX_SUBSTITUTION_LEVEL 10
+
+void startSubstitution();
+char* substitute(Arena* arena, char* token, size_t length);
+
+#endif
@@ -0,0 +1,86 @@
+/*******
+ * Tokenizer throughput benchmark
+ *    Builds long generated lines (words of 1-8, 1-20, 1-40 or 1-1000 characters with some
+ *    quoted strings, pipes and semicolons) and reports how many MB/s
+ *    getNextToken gets through.
+ *    Build as tokenBench (vector scanner) and tokenBenchScalar
+ *    (table-only scanner) to compare.
+ *
+ *    Usage: tokenBench [lineMB] [repeats]   (defaults: 4 20)
+ *******/
+
+#include "tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***
+ * makeLine:
+ *    A line of about size bytes with words of at most maxWord characters
+ ***/
+static char* makeLine(size_t size, int maxWord) {
+  char* line = malloc(size + maxWord + 8);   // Room for the last word to run over
+  size_t len = 0;
+  while (len < size) {
+    int kind = random() % 20;
+    int word = 1 + random() % maxWord;
+    int c;
+    if (kind == 0) {
+      line[len++] = '|';
+    } else if (kind == 1) {
+      line[len++] = ';';
+    } else if (kind == 2 || kind == 3) {
+      char quote = (kind == 2) ? '\'' : '"';
+      line[len++] = quote;
+      for (c = 0; c < word; c++) line[len++] = (c % 6 == 5) ? ' ' : 'a' + random() % 26;
+      line[len++] = quote;
+    } else {
+      for (c = 0; c < word; c++) line[len++] = 'a' + random() % 26;
+    }
+    line[len++] = ' ';
+  }
+  line[len] = '\0';
+  return line;
+}
+
+static void runBench(const char* name, size_t size, int maxWord, int repeats) {
+  char* line = makeLine(size, maxWord);
+  size_t len = strlen(line);
+  char* work = malloc(len + 1);
+  double total = 0;
+  long tokens = 0;
+  int r;
+
+  for (r = 0; r < repeats; r++) {
+    memcpy(work, line, len + 1);   // Tokenizing alters the line
+    double start = now();
+    startTokenInPlace(work);
+    aToken t;
+    while ((t = getNextToken()).type != EOL && t.type != ERROR) tokens++;
+    total += now() - start;
+  }
+
+  printf("%-14s %6.1f MB line: %8.1f MB/s  (%ld tokens/pass)\n",
+	 name, len / 1e6, len * (double) repeats / total / 1e6, tokens / repeats);
+  free(work);
+  free(line);
+}
+
+int main(int argc, char* argv[]) {
+  size_t size = (size_t) ((argc > 1) ? atof(argv[1]) : 4) * 1000000;
+  int repeats = (argc > 2) ? atoi(argv[2]) : 20;
+
+  srandom(399);
+  runBench("short words", size, 8, repeats);
+  runBench("medium words", size, 20, repeats);
+  runBench("long words", size, 40, repeats);
+  runBench("huge words", size, 1000, repeats);
+  return 0;
+}
@@ -9,20 +9,170 @@
  * See Tokenizer.h for details...
  *******/
 #include "tokenizer.h"
-#include "varset.h"
+#include "varSet.h"
 #include "global.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(SCALAR_TOKENIZER)
+#define SIMD_TOKENIZER
+#include <immintrin.h>
+#endif
+
+/***
+ * Character classes - one table lookup tells what a byte means
+ * instead of a chain of comparisons.
+ ***/
+#define CC_SPACE       1   // Whitespace between tokens
+#define CC_END_BASIC   2   // Ends a BASIC token (whitespace, |, ;, &, <, > or end of line)
+#define CC_END_SINGLE  4   // Ends a 'single quoted' token
+#define CC_END_DOUBLE  8   // Ends a "double quoted" token
+
+static const unsigned char charClass[256] = {
+  ['\0'] = CC_END_BASIC | CC_END_SINGLE | CC_END_DOUBLE,
+  [' ']  = CC_SPACE | CC_END_BASIC,
+  ['\t'] = CC_SPACE | CC_END_BASIC,
+  ['\n'] = CC_SPACE | CC_END_BASIC,
+  ['|']  = CC_END_BASIC,
+  [';']  = CC_END_BASIC,
+  ['&']  = CC_END_BASIC,
+  ['<']  = CC_END_BASIC,
+  ['>']  = CC_END_BASIC,
+  ['\''] = CC_END_SINGLE,
+  ['\"'] = CC_END_DOUBLE,
+};
 
 static char* tokLine = NULL;
 static char* currTokPos;
+static char pendingDelim = '\0';  // A |, ;, &, < or > that ended the last BASIC token
 int i;
 char tempStr[100];
 char* fakeInput = "HELLO";
 char wordSet[3];
 
+/***
+ * scanScalar:
+ *    Return the first position at or after p whose byte is in class cls
+ *    (every class includes '\0', so this stops at the end of the line).
+ ***/
+static char* scanScalar(char* p, int cls) {
+  while (!(charClass[(unsigned char) *p] & cls)) p++;
+  return p;
+}
+
+#ifdef SIMD_TOKENIZER
+/***
+ * The vector scanners look at 16 (SSE2) or 32 (AVX2) bytes at a time.
+ * Loads are aligned, so they never cross into a page past the end of
+ * the line; bytes before p in the first block are masked off.
+ ***/
+__attribute__((target("sse2")))
+static unsigned int matchSse2(__m128i v, int cls) {
+  __m128i hit = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+  if (cls == CC_END_BASIC) {
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+  } else {
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(cls == CC_END_SINGLE ? '\'' : '"')));
+  }
+  return (unsigned int) _mm_movemask_epi8(hit);
+}
+
+__attribute__((target("sse2")))
+static char* scanSse2(char* p, int cls) {
+  uintptr_t offset = (uintptr_t) p & 15;
+  char* block = p - offset;
+  unsigned int mask = matchSse2(_mm_load_si128((__m128i*) block), cls) & (0xFFFFu << offset);
+  while (mask == 0) {
+    block += 16;
+    mask = matchSse2(_mm_load_si128((__m128i*) block), cls);
+  }
+  return block + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2")))
+static unsigned int matchAvx2(__m256i v, int cls) {
+  __m256i hit = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+  if (cls == CC_END_BASIC) {
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+  } else {
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(cls == CC_END_SINGLE ? '\'' : '"')));
+  }
+  return (unsigned int) _mm256_movemask_epi8(hit);
+}
+
+__attribute__((target("avx2")))
+static char* scanAvx2(char* p, int cls) {
+  uintptr_t offset = (uintptr_t) p & 31;
+  char* block = p - offset;
+  unsigned int mask = matchAvx2(_mm256_load_si256((__m256i*) block), cls) & (0xFFFFFFFFu << offset);
+  while (mask == 0) {
+    block += 32;
+    mask = matchAvx2(_mm256_load_si256((__m256i*) block), cls);
+  }
+  return block + __builtin_ctz(mask);
+}
+
+/***
+ * scanTo:
+ *    Most tokens are short, so the first SHORT_SCAN bytes are checked with
+ *    the table before switching to the widest vector scanner this CPU
+ *    supports (chosen the first time it is needed).  The table check is
+ *    unrolled: with a loop counter, short words ran slower than the plain
+ *    table scan (tokenBench at -O2 - short 248-260 MB/s vs 268-284).
+ *    Unrolled, tokenBench at -O2 with SHORT_SCAN of:
+ *       8: short 251-267  medium 477-532  long 790-809  huge 4018-4350 MB/s
+ *      16: short 276-292  medium 502-516  long 799-860  huge 4084-4301
+ *      24: short 276-285  medium 485-519  long 767-827  huge 4112-4446
+ *      32: short 260-275  medium 454-481  long 675-750  huge 3738-4080
+ *    table only: short 268-284  medium 449-454  long 659-673  huge 2260-2319
+ *    (Build with -DSHORT_SCAN=n to try another.)
+ ***/
+#ifndef SHORT_SCAN
+#define SHORT_SCAN 16
+#endif
+
+static char* pickScanner(char* p, int cls);
+static char* (*scanVector)(char* p, int cls) = pickScanner;
+
+static char* pickScanner(char* p, int cls) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) scanVector = scanAvx2;
+  else if (__builtin_cpu_supports("sse2")) scanVector = scanSse2;
+  else scanVector = scanScalar;
+  return scanVector(p, cls);
+}
+
+static char* scanTo(char* p, int cls) {
+  int n;
+#pragma GCC unroll 64   // (All SHORT_SCAN of them)
+  for (n = 0; n < SHORT_SCAN; n++, p++) {
+    if (charClass[(unsigned char) *p] & cls) return p;
+  }
+  return scanVector(p, cls);
+}
+#else
+#define scanTo scanScalar
+#endif
+
 void startToken(char* line) {
+  pendingDelim = '\0';
+
   if (line == NULL) {
     // Hey, no line even passed
     fprintf(stderr, "ERROR: Null line given.  Using empty line.\n");
@@ -45,19 +195,52 @@ void startToken(char* line) {
   currTokPos = tokLine;
 }
 
+void startTokenInPlace(char* line) {
+  pendingDelim = '\0';
+
+  if (line == NULL) {
+    // Hey, no line even passed
+    fprintf(stderr, "ERROR: Null line given.  Using empty line.\n");
+    currTokPos = NULL;
+    return;
+  }
+
+  // No copy - tokens are cut directly out of the caller's buffer
+  currTokPos = line;
+}
+
 aToken getNextToken() {
   aToken res;
+  if (pendingDelim != '\0') {
+    // The previous BASIC token was ended directly by a delimiter
+    res.start = NULL;
+    switch (pendingDelim) {
+    case '|': res.type = PIPE; break;
+    case ';': res.type = SEMICOLON; break;
+    case '&': res.type = AMPERSAND; break;
+    case '<': res.type = REDIRECT_IN; break;
+    default:
+      res.type = REDIRECT_OUT;
+      if (*currTokPos == '>') {   // (The first > was overwritten - this is the second)
+	res.type = REDIRECT_APPEND;
+	currTokPos++;
+      }
+    }
+    res.length = 0;
+    pendingDelim = '\0';
+    return res;
+  }
+
   if (currTokPos == NULL || *currTokPos == '\0') {
     // End of line reached.  (Nothing left to parse)
     res.type = EOL;
     res.start = NULL;
+    res.length = 0;
     return res;
   }
 
   // Find the first non-white space
-  while (*currTokPos == ' ' ||
-	 *currTokPos == '\t' ||
-	 *currTokPos == '\n')
+  while (charClass[(unsigned char) *currTokPos] & CC_SPACE)
     currTokPos++;
 
   switch (*currTokPos) {
@@ -65,6 +248,7 @@ aToken getNextToken() {
     // We have reached the end of the line... 
     res.type = EOL;
     res.start = NULL;
+    res.length = 0;
     return res;
 
   case '\'':
@@ -73,8 +257,7 @@ aToken getNextToken() {
     res.type = SINGLE_QUOTE;   // Store type as SINGLE_QUOTE
     
     // Find end of token (using ' as delimiter)
-    while (*currTokPos != '\'' &&
-	   *currTokPos != '\0') currTokPos++;
+    currTokPos = scanTo(currTokPos, CC_END_SINGLE);
     break;
     
   case '\"':
@@ -82,9 +265,8 @@ aToken getNextToken() {
     res.start = ++currTokPos;  // Skipping the quotes
     res.type = DOUBLE_QUOTE;   // Store type as DOUBLE_QUOTE
 
-    // Find end of token (using ' as delimiter)
-    while (*currTokPos != '\"' &&
-	   *currTokPos != '\0') currTokPos++;
+    // Find end of token (using " as delimiter)
+    currTokPos = scanTo(currTokPos, CC_END_DOUBLE);
     break;
 
   case '|':
@@ -100,11 +282,36 @@ aToken getNextToken() {
     res.type = SEMICOLON;  // Store type as SEMICOLON
     ++currTokPos;      // Skip the semicolon
     break;
+
+  case '&':
+    // We have an ampersand (a statement to run in the background)
+    res.start = NULL;
+    res.type = AMPERSAND;
+    ++currTokPos;
+    break;
+
+  case '<':
+    // Input redirection
+    res.start = NULL;
+    res.type = REDIRECT_IN;
+    ++currTokPos;
+    break;
+
+  case '>':
+    // Output redirection (>> appends)
+    res.start = NULL;
+    res.type = REDIRECT_OUT;
+    if (*(++currTokPos) == '>') {
+      res.type = REDIRECT_APPEND;
+      ++currTokPos;
+    }
+    break;
     
   case '#':
     // We have a comment -- we set the start to null and type to COMMENT so we can begin processing the next line
     res.start = NULL;
     res.type = COMMENT; // store type as comment
+    currTokPos += strlen(currTokPos);   // The rest of the line is the comment
     break;
 
   default:
@@ -112,12 +319,17 @@ aToken getNextToken() {
     res.start = currTokPos;
     res.type = BASIC;
 
-    // Find end of token (using regular delimiters)
-    while (*currTokPos != ' ' &&
-	   *currTokPos != '\t' &&
-	   *currTokPos != '\n' &&
-	   *currTokPos != '\0')
-      currTokPos++;
+    // Find end of token (using regular delimiters - a pipe, semicolon, ampersand or redirection also ends it)
+    currTokPos = scanTo(currTokPos, CC_END_BASIC);
+
+    // Remember the delimiter since it is overwritten below
+    if (!(charClass[(unsigned char) *currTokPos] & CC_SPACE)) pendingDelim = *currTokPos;
+  }
+
+  res.length = (res.start != NULL) ? (size_t) (currTokPos - res.start) : 0;
+  if (res.start == NULL) {
+    // A delimiter (already skipped) - what follows it is the next token
+    return res;
   }
   
   if (*currTokPos != '\0') {
@@ -8,6 +8,8 @@
  *
  * Tokens are defined as follows:
  *    A collection of continuous non-whitespace characters.
+ *    A |, ;, &, < or > (or >>) also ends a token (and is then returned as
+ *    the next token) so a|b;c&d>e is the same as a | b ; c & d > e
  *
  *    Whitespace:
  *       Is defined as space (' '), tab ('\t') or newline ('\n')
@@ -40,13 +42,17 @@
 
 #ifndef __TOKENIZER_H
 #define __TOKENIZER_H
+#include <stddef.h>
+
 /***
- * A token: storing start of the token string
+ * A token: storing start of the token string, its length
  *  and the type of the token.
  ***/
 typedef struct {
   char *start;
-  enum { BASIC, SINGLE_QUOTE, DOUBLE_QUOTE, PIPE, SEMICOLON, EOL, ERROR, COMMENT } type;
+  size_t length;   // Length of the string at start (0 if start is NULL)
+  enum { BASIC, SINGLE_QUOTE, DOUBLE_QUOTE, PIPE, SEMICOLON, AMPERSAND,
+	 REDIRECT_IN, REDIRECT_OUT, REDIRECT_APPEND, EOL, ERROR, COMMENT } type;
 } aToken;
 
 /***
@@ -61,6 +67,17 @@ typedef struct {
  ***/
 void startToken(char *line);
 
+/***
+ * startTokenInPlace:
+ *    Same as startToken but NO copy is made: the tokens are cut out of
+ *    line itself (delimiters are overwritten with '\0'), so the token
+ *    strings stay valid for as long as the caller keeps line around.
+ *
+ *    line: A pointer to the start of the null-terminated string for this line.
+ *          It IS altered.
+ ***/
+void startTokenInPlace(char *line);
+
 /***
  * getNextToken:
  *    Return the next token in the current line as a struct (aToken).
@@ -74,16 +91,22 @@ void startToken(char *line);
  *      DOUBLE_QUOTE: If token is "double quoted string"
  *      PIPE: If token is '|'
  *      SEMICOLON: If token is ';'
+ *      AMPERSAND: If token is '&'
+ *      REDIRECT_IN, REDIRECT_OUT, REDIRECT_APPEND: If token is '<', '>' or '>>'
  *	COMMENT: If token starts with '#'
  *
  *    Returns aToken.start:
  *      If not EOL or ERROR, then start points to start of the string
  *      (and string is null-terminated)
+ *    Returns aToken.length:
+ *      The length of that string (a (start, length) slice of the line)
  *
  **********************************************
  *    WARNING: This start string is ONLY temporary.  A subsequent call to 
  *      getNextToken/startToken will possibly erase it.  So caller MUST
  *      make a local copy if further use is needed!
+ *      (Unless the line was started with startTokenInPlace - then it
+ *      lives as long as the caller's line.)
  **********************************************
  ***/
 aToken getNextToken();
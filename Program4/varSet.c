@@ -1,7 +1,7 @@
 /*******
  * Christian Duncan
  *
- * VarSet: 
+ * VarSet:
  *    See varSet.h for details.
  *******/
 
@@ -11,52 +11,185 @@
 #include <stdio.h>
 #include <string.h>
 
+#define INITIAL_CAPACITY 16
+#define MIGRATE_STEP 4      // Old slots moved over per operation (while resizing)
+
+// Marks the slot of a removed entry (so probe chains through it stay intact)
+static VarEntry tombstone;
+#define TOMBSTONE (&tombstone)
+
+/***
+ * hashName:
+ *    FNV-1a hash of the first len characters of name
+ ***/
+static unsigned int hashName(const char* name, size_t len) {
+  unsigned int h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/***
+ * probe:
+ *    Find the slot for the given name in the slot array
+ *    Returns the slot holding the matching entry or the empty slot
+ *    where it would be inserted.
+ ***/
+static VarEntry** probe(VarEntry** slots, size_t capacity, const char* name,
+			size_t len, unsigned int h) {
+  size_t mask = capacity - 1;
+  size_t i = h & mask;
+  while (slots[i] != NULL) {
+    VarEntry* e = slots[i];
+    if (e != TOMBSTONE && e->hash == h && e->length == len && memcmp(e->name, name, len) == 0) {
+      return &slots[i];  // Found it
+    }
+    i = (i + 1) & mask;
+  }
+  return &slots[i];  // The empty slot
+}
+
+/***
+ * migrate:
+ *    Move up to steps slots of the old array (if any) into the current one.
+ *    The old slots are not cleared (so probe chains there stay intact
+ *    for lookups) - only the migrated marker advances.
+ ***/
+static void migrate(VarSet* set, size_t steps) {
+  if (set->oldSlots == NULL) return;   // Not resizing
+
+  while (steps-- > 0 && set->migrated < set->oldCapacity) {
+    VarEntry* e = set->oldSlots[set->migrated++];
+    if (e != NULL && e != TOMBSTONE) {
+      *probe(set->slots, set->capacity, e->name, e->length, e->hash) = e;
+    }
+  }
+
+  if (set->migrated == set->oldCapacity) {
+    // All done - the old array is no longer needed
+    free(set->oldSlots);
+    set->oldSlots = NULL;
+    set->oldCapacity = 0;
+    set->migrated = 0;
+  }
+}
+
+/***
+ * grow:
+ *    Start an incremental resize to twice the current capacity
+ *    (or the same capacity if the table is mostly tombstones).
+ *    Returns 0 if out of memory (the set still works, just more crowded).
+ ***/
+static int grow(VarSet* set) {
+  // Finish any resize still in progress first
+  migrate(set, set->oldCapacity);
+
+  size_t newCapacity = set->capacity;
+  if ((set->count + 1) * 2 > set->capacity) newCapacity *= 2;
+
+  VarEntry** bigger = calloc(newCapacity, sizeof(VarEntry*));
+  if (bigger == NULL) return 0;
+
+  set->oldSlots = set->slots;
+  set->oldCapacity = set->capacity;
+  set->migrated = 0;
+  set->slots = bigger;
+  set->capacity = newCapacity;
+  set->tombstones = 0;
+  return 1;
+}
+
+/***
+ * lookup:
+ *    Find the entry for name (of length len, hash h) in either slot array
+ ***/
+static VarEntry* lookup(VarSet* set, const char* name, size_t len, unsigned int h) {
+  VarEntry* e = *probe(set->slots, set->capacity, name, len, h);
+  if (e == NULL && set->oldSlots != NULL) {
+    e = *probe(set->oldSlots, set->oldCapacity, name, len, h);
+  }
+  return e;
+}
+
 /***
  * createVarSet:
- *   Create a variable set (or one entry in the set)
+ *   Create an empty variable set
  ***/
 VarSet* createVarSet() {
   VarSet* ans = malloc(sizeof(VarSet));
-  ans->name = NULL;
-  ans->value = NULL;
-  ans->next = NULL;
+  ans->slots = calloc(INITIAL_CAPACITY, sizeof(VarEntry*));
+  ans->capacity = INITIAL_CAPACITY;
+  ans->count = 0;
+  ans->tombstones = 0;
+  ans->oldSlots = NULL;
+  ans->oldCapacity = 0;
+  ans->migrated = 0;
+  ans->head = NULL;
   return ans;
 }
 
 /***
  * freeVarSet:
- *    Free up the variable set (delete the linked list and contents)
+ *    Free up the variable set (the table, the entries and contents)
  *    Must also free all OWNED references.
  ***/
 void freeVarSet(VarSet* set) {
-  VarSet* curr = set;
+  VarEntry* curr = set->head;
   while (curr != NULL) {
-    if (curr->name != NULL) free(curr->name);
+    VarEntry* next = curr->next;
     if (curr->value != NULL) free(curr->value);
-    VarSet* next = curr->next;
-    free(curr);
+    free(curr);   // The name is stored in the same block
     curr = next;
   }
+  free(set->slots);
+  free(set->oldSlots);
+  free(set);
 }
 
 /***
  * addToSet:
  *    Add the given name/value to the set
  *    If name exists - replace with new value
- *    If not, add the name/value to the list
+ *    If not, add the name/value to the set
  ***/
 void addToSet(VarSet* set, char* name, char* value) {
-  assert(set != NULL);  // Using a dummy head node - so verify it is created.
+  assert(set != NULL);
+
+  migrate(set, MIGRATE_STEP);
 
   // First lookup variable (if already exists)
-  VarSet* locate = findInSet(set, name);
+  size_t len = strlen(name);
+  unsigned int h = hashName(name, len);
+  VarEntry* locate = lookup(set, name, len, h);
   if (locate == NULL) {
-    // We have a new variable!
-    locate = createVarSet();
-    locate->name = strdup(name);
+    // We have a new variable!  Keep the load factor (tombstones included) under 3/4
+    if ((set->count + set->tombstones + 1) * 4 > set->capacity * 3 &&
+	!grow(set) && set->count + set->tombstones + 1 >= set->capacity) {
+      // Could not grow and no room to spare - probe needs an empty slot to stop at
+      fprintf(stderr, ">> Error: Out of memory.  Variable not added.\n");
+      return;
+    }
+
+    // Intern the name in the same block as the entry
+    locate = malloc(sizeof(VarEntry) + len + 1);
+    if (locate == NULL) {
+      fprintf(stderr, ">> Error: Out of memory.  Variable not added.\n");
+      return;
+    }
+    locate->name = (char*) (locate + 1);
+    memcpy(locate->name, name, len + 1);
     locate->value = strdup(value);
-    locate->next = set->next;
-    set->next = locate;
+    locate->hash = h;
+    locate->length = len;
+    locate->next = set->head;
+    locate->prev = NULL;
+    if (set->head != NULL) set->head->prev = locate;
+    set->head = locate;
+    *probe(set->slots, set->capacity, name, len, h) = locate;
+    set->count++;
   } else {
     // Replace
     if (locate->value != NULL) {
@@ -69,35 +202,63 @@ void addToSet(VarSet* set, char* name, char* value) {
 /***
  * findInSet:
  *    Searches for a given name in the set
- *    Returns the reference in the list for the matching name
+ *    Returns the entry for the matching name
  *    or NULL if not found.
  *    Matching is case sensitive.
  ***/
-VarSet* findInSet(VarSet* set, char* name) {
-  assert(set != NULL);   // Using a dummy head node - so verify it is created.
-
-  VarSet* curr;
-  for (curr = set->next; curr != NULL; curr = curr->next) {
-    if (strcmp(name, curr->name) == 0) {
-      // Found it
-      return curr;
+VarEntry* findInSet(VarSet* set, char* name) {
+  assert(set != NULL);
+
+  migrate(set, MIGRATE_STEP);
+
+  size_t len = strlen(name);
+  return lookup(set, name, len, hashName(name, len));
+}
+
+/***
+ * removeFromSet:
+ *    Remove the variable with the given name (if it exists)
+ ***/
+void removeFromSet(VarSet* set, char* name) {
+  assert(set != NULL);
+
+  size_t len = strlen(name);
+  unsigned int h = hashName(name, len);
+  VarEntry** slot = probe(set->slots, set->capacity, name, len, h);
+  VarEntry* e = *slot;
+  if (e != NULL) {
+    *slot = TOMBSTONE;
+    set->tombstones++;
+  }
+  if (set->oldSlots != NULL) {
+    // It may also (or only) still be in the array being migrated
+    VarEntry** oldSlot = probe(set->oldSlots, set->oldCapacity, name, len, h);
+    if (*oldSlot != NULL) {
+      e = *oldSlot;
+      *oldSlot = TOMBSTONE;
     }
   }
+  if (e == NULL) return;   // Not in the set
+
+  // Unlink from the listing order
+  if (e->prev != NULL) e->prev->next = e->next;
+  else set->head = e->next;
+  if (e->next != NULL) e->next->prev = e->prev;
 
-  // Nothing found
-  return NULL;
+  set->count--;
+  if (e->value != NULL) free(e->value);
+  free(e);
 }
 
 /***
  * printSet:
- *    Print the given set to the stream
+ *    Print the given set to the stream (newest variable first)
  ***/
 void printSet(VarSet* set, FILE* stream) {
-  assert(set != NULL);   // Using a dummy head node - so verify it is created.
+  assert(set != NULL);
 
-  VarSet* curr;
-  for (curr = set->next; curr != NULL; curr = curr->next) {
+  VarEntry* curr;
+  for (curr = set->head; curr != NULL; curr = curr->next) {
     fprintf(stream, "%s: %s\n", curr->name, curr->value);
   }
 }
-
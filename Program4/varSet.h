@@ -1,10 +1,16 @@
 /*******
  * Christian Duncan
  *
- * VarSet: 
+ * VarSet:
  *    Representing a set of variables
  *    Each entry in the set contains a name and value
- *    In our implementation this is a linked list (with dummy head node)
+ *    In our implementation this is an open-addressing hash table
+ *    (linear probing) of entries.  The entries are also threaded on a
+ *    linked list (newest first) so the set can be listed in a stable order.
+ *    When the table grows it is resized incrementally: the old slot array
+ *    is kept around and a few of its slots are moved over on every
+ *    operation until it is empty (so no single SET pays for a full rehash).
+ *    Removed entries leave a tombstone slot behind until the next resize.
  *    Several functions are provided to access/use this set.
  *******/
 
@@ -13,16 +19,31 @@
 
 #include <stdio.h>
 
+typedef struct varEntry {
+  char* name;            // The interned name (REFERENCE is OWNED - stored inside this entry)
+  char* value;           // REFERENCE is OWNED
+  unsigned int hash;     // Cached hash of name
+  size_t length;         // Cached length of name
+  struct varEntry *next; // Next in listing order (REFERENCE is OWNED)
+  struct varEntry *prev; // Previous in listing order (REFERENCE is BORROWED)
+} VarEntry;
+
 typedef struct varSet {
-  char* name;   // REFERENCE is OWNED
-  char* value;  // REFERENCE is OWNED
-  struct varSet *next;  // REFERENCE is OWNED
+  VarEntry** slots;      // The current slot array (REFERENCE is OWNED)
+  size_t capacity;       // Number of slots (always a power of 2)
+  size_t count;          // Number of entries stored
+  size_t tombstones;     // Slots in slots marking a removed entry
+  VarEntry** oldSlots;   // Slot array still being migrated, or NULL (REFERENCE is OWNED)
+  size_t oldCapacity;    // Number of slots in oldSlots
+  size_t migrated;       // Slots of oldSlots already moved over
+  VarEntry* head;        // Newest entry - start of the listing order (REFERENCE is OWNED)
 } VarSet;
 
 VarSet* createVarSet();
 void freeVarSet(VarSet* set);
 void addToSet(VarSet* set, char* name, char* value);
-VarSet* findInSet(VarSet* set, char* name);
+VarEntry* findInSet(VarSet* set, char* name);
+void removeFromSet(VarSet* set, char* name);
 void printSet(VarSet* set, FILE* stream);
 
 #endif